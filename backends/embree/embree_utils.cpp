@@ -1,25 +1,25 @@
 #include "embree_utils.h"
 #include <algorithm>
+#include <array>
 #include <iterator>
 #include <limits>
+#include "util.h"
 #include <glm/ext.hpp>
 
 namespace embree {
 
 Geometry::Geometry(RTCDevice &device,
-                   const std::vector<glm::vec3> &verts,
-                   const std::vector<glm::uvec3> &indices,
-                   const std::vector<glm::vec3> &normals,
-                   const std::vector<glm::vec2> &uvs)
-    : n_vertices(verts.size()),
-      vertex_buf(verts),
+                   const GeometryBuffer<glm::vec3> &verts,
+                   const GeometryBuffer<glm::uvec3> &indices,
+                   const GeometryBuffer<glm::vec3> &normals,
+                   const GeometryBuffer<glm::vec2> &uvs)
+    : vertex_buf(verts),
       index_buf(indices),
       normal_buf(normals),
       uv_buf(uvs),
       geom(rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE))
 {
-    // Pad the vertex_buf out to align it
-    vertex_buf.push_back(glm::vec3(0.f));
+    vertex_buf.pad(1);
 
     rtcSetSharedGeometryBuffer(geom,
                                RTC_BUFFER_TYPE_VERTEX,
@@ -28,7 +28,7 @@ Geometry::Geometry(RTCDevice &device,
                                vertex_buf.data(),
                                0,
                                sizeof(glm::vec3),
-                               n_vertices);
+                               vertex_buf.size());
     rtcSetSharedGeometryBuffer(geom,
                                RTC_BUFFER_TYPE_INDEX,
                                0,
@@ -60,9 +60,14 @@ ISPCGeometry::ISPCGeometry(const Geometry &geom)
     }
 }
 
-TriangleMesh::TriangleMesh(RTCDevice &device, std::vector<std::shared_ptr<Geometry>> &geoms)
+TriangleMesh::TriangleMesh(RTCDevice &device,
+                           std::vector<std::shared_ptr<Geometry>> &geoms,
+                           const BVHSettings &settings)
     : scene(rtcNewScene(device)), geometries(geoms)
 {
+    rtcSetSceneBuildQuality(scene, settings.quality);
+    rtcSetSceneFlags(scene, settings.flags);
+
     ispc_geometries.reserve(geometries.size());
     std::transform(geometries.begin(),
                    geometries.end(),
@@ -72,7 +77,6 @@ TriangleMesh::TriangleMesh(RTCDevice &device, std::vector<std::shared_ptr<Geomet
     for (auto &g : geometries) {
         rtcAttachGeometry(scene, g->geom);
     }
-    rtcCommitScene(scene);
 }
 
 TriangleMesh::~TriangleMesh()
@@ -82,6 +86,11 @@ TriangleMesh::~TriangleMesh()
     }
 }
 
+void TriangleMesh::commit()
+{
+    rtcCommitScene(scene);
+}
+
 RTCScene TriangleMesh::handle()
 {
     return scene;
@@ -103,6 +112,20 @@ Instance::Instance(RTCDevice &device,
     rtcCommitGeometry(handle);
 }
 
+Instance::Instance(RTCDevice &device,
+                   std::shared_ptr<TopLevelBVH> &group,
+                   const glm::mat4 &xfm)
+    : handle(rtcNewGeometry(device, RTC_GEOMETRY_TYPE_INSTANCE)),
+      group(group),
+      object_to_world(xfm),
+      world_to_object(glm::inverse(object_to_world))
+{
+    rtcSetGeometryInstancedScene(handle, group->handle);
+    rtcSetGeometryTransform(
+        handle, 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR, glm::value_ptr(object_to_world));
+    rtcCommitGeometry(handle);
+}
+
 Instance::~Instance()
 {
     if (handle) {
@@ -111,16 +134,25 @@ Instance::~Instance()
 }
 
 ISPCInstance::ISPCInstance(const Instance &instance)
-    : geometries(instance.mesh->ispc_geometries.data()),
-      object_to_world(glm::value_ptr(instance.object_to_world)),
-      world_to_object(glm::value_ptr(instance.world_to_object)),
-      material_ids(instance.material_ids.data())
+    : object_to_world(glm::value_ptr(instance.object_to_world)),
+      world_to_object(glm::value_ptr(instance.world_to_object))
 {
+    if (instance.mesh) {
+        geometries = instance.mesh->ispc_geometries.data();
+        material_ids = instance.material_ids.data();
+    } else {
+        children = instance.group->ispc_instances.data();
+    }
 }
 
-TopLevelBVH::TopLevelBVH(RTCDevice &device, const std::vector<std::shared_ptr<Instance>> &inst)
+TopLevelBVH::TopLevelBVH(RTCDevice &device,
+                         const std::vector<std::shared_ptr<Instance>> &inst,
+                         const BVHSettings &settings)
     : handle(rtcNewScene(device)), instances(inst)
 {
+    rtcSetSceneBuildQuality(handle, settings.quality);
+    rtcSetSceneFlags(handle, settings.flags);
+
     for (const auto &i : instances) {
         rtcAttachGeometry(handle, i->handle);
         ispc_instances.push_back(*i);
@@ -135,8 +167,23 @@ TopLevelBVH::~TopLevelBVH()
     }
 }
 
+std::array<float, 256> make_texel_lut(const ColorSpace color_space)
+{
+    std::array<float, 256> lut;
+    for (size_t i = 0; i < lut.size(); ++i) {
+        lut[i] = i / 255.f;
+        if (color_space == SRGB) {
+            lut[i] = srgb_to_linear(lut[i]);
+        }
+    }
+    return lut;
+}
+
 ISPCTexture2D::ISPCTexture2D(const Image &img)
     : width(img.width), height(img.height), channels(img.channels), data(img.img.data())
 {
+    static const std::array<float, 256> linear_lut = make_texel_lut(LINEAR);
+    static const std::array<float, 256> srgb_lut = make_texel_lut(SRGB);
+    texel_lut = img.color_space == SRGB ? srgb_lut.data() : linear_lut.data();
 }
 }
@@ -4,30 +4,39 @@
 #include <utility>
 #include <vector>
 #include <embree4/rtcore.h>
+#include "geometry_buffer.h"
 #include "lights.h"
 #include "material.h"
 #include <glm/glm.hpp>
 
 namespace embree {
 
+// The build quality and scene flags used when building the BVHs
+struct BVHSettings {
+    RTCBuildQuality quality = RTC_BUILD_QUALITY_MEDIUM;
+    RTCSceneFlags flags = RTC_SCENE_FLAG_NONE;
+};
+
+/* The geometry shares the scene's buffers with Embree instead of copying them. Embree
+ * reads the last vertex as 16 bytes, so vertex_buf must be padded by an extra vec3. The
+ * scene pads its vertex buffers when loading, vertex buffers which aren't padded are
+ * copied and padded here.
+ */
 struct Geometry {
-    // vertex_buf is padded out by an extra vec3 for Embree's alignment requirements
-    // n_vertices = the real # of vertices, ie vertex_buf.size() - 1
-    size_t n_vertices = 0;
-    std::vector<glm::vec3> vertex_buf;
-    std::vector<glm::uvec3> index_buf;
-    std::vector<glm::vec3> normal_buf;
-    std::vector<glm::vec2> uv_buf;
+    GeometryBuffer<glm::vec3> vertex_buf;
+    GeometryBuffer<glm::uvec3> index_buf;
+    GeometryBuffer<glm::vec3> normal_buf;
+    GeometryBuffer<glm::vec2> uv_buf;
 
     RTCGeometry geom = 0;
 
     Geometry() = default;
 
     Geometry(RTCDevice &device,
-             const std::vector<glm::vec3> &verts,
-             const std::vector<glm::uvec3> &indices,
-             const std::vector<glm::vec3> &normals,
-             const std::vector<glm::vec2> &uvs);
+             const GeometryBuffer<glm::vec3> &verts,
+             const GeometryBuffer<glm::uvec3> &indices,
+             const GeometryBuffer<glm::vec3> &normals,
+             const GeometryBuffer<glm::vec2> &uvs);
 
     ~Geometry();
 
@@ -54,19 +63,32 @@ public:
 
     TriangleMesh() = default;
 
-    TriangleMesh(RTCDevice &device, std::vector<std::shared_ptr<Geometry>> &geometries);
+    // The mesh's BVH isn't built until commit is called, so that the meshes in a scene
+    // can be built in parallel
+    TriangleMesh(RTCDevice &device,
+                 std::vector<std::shared_ptr<Geometry>> &geometries,
+                 const BVHSettings &settings = BVHSettings());
 
     ~TriangleMesh();
 
     TriangleMesh(const TriangleMesh &) = delete;
     TriangleMesh &operator=(const TriangleMesh &) = delete;
 
+    // Build the mesh's BVH
+    void commit();
+
     RTCScene handle();
 };
 
+struct TopLevelBVH;
+
+/* An instance of either a mesh, or of the BVH of an instance group for multi-level
+ * instancing. Only one of mesh or group is set
+ */
 struct Instance {
     RTCGeometry handle = 0;
     std::shared_ptr<TriangleMesh> mesh = nullptr;
+    std::shared_ptr<TopLevelBVH> group = nullptr;
     glm::mat4 object_to_world, world_to_object;
     std::vector<uint32_t> material_ids;
 
@@ -77,6 +99,10 @@ struct Instance {
              const glm::mat4 &object_to_world,
              const std::vector<uint32_t> &material_ids);
 
+    Instance(RTCDevice &device,
+             std::shared_ptr<TopLevelBVH> &group,
+             const glm::mat4 &object_to_world);
+
     ~Instance();
 
     Instance(const Instance &) = delete;
@@ -88,18 +114,24 @@ struct ISPCInstance {
     const float *object_to_world = nullptr;
     const float *world_to_object = nullptr;
     const uint32_t *material_ids = nullptr;
+    // The instances in the group for instances of an instance group, indexed by the
+    // instance ID of the next level of instancing
+    const ISPCInstance *children = nullptr;
 
     ISPCInstance() = default;
     ISPCInstance(const Instance &instance);
 };
 
+// The BVH over a set of instances, either the scene or an instance group
 struct TopLevelBVH {
     RTCScene handle = 0;
     std::vector<std::shared_ptr<Instance>> instances;
     std::vector<ISPCInstance> ispc_instances;
 
     TopLevelBVH() = default;
-    TopLevelBVH(RTCDevice &device, const std::vector<std::shared_ptr<Instance>> &instances);
+    TopLevelBVH(RTCDevice &device,
+                const std::vector<std::shared_ptr<Instance>> &instances,
+                const BVHSettings &settings = BVHSettings());
     ~TopLevelBVH();
 
     TopLevelBVH(const TopLevelBVH &) = delete;
@@ -111,6 +143,9 @@ struct ISPCTexture2D {
     int height = -1;
     int channels = -1;
     const uint8_t *data = nullptr;
+    // Table mapping 8-bit texel values to linear floats, sRGB textures are linearized
+    // through the table instead of converting a copy of the texture beforehand
+    const float *texel_lut = nullptr;
 
     ISPCTexture2D(const Image &img);
     ISPCTexture2D() = default;
@@ -137,6 +172,8 @@ struct MaterialParams {
 struct ViewParams {
     glm::vec3 pos, dir_du, dir_dv, dir_top_left;
     uint32_t frame_id;
+    // The samples per pixel taken in the frames accumulated before this one
+    uint32_t sample_offset;
 };
 
 struct SceneContext {
@@ -145,16 +182,55 @@ struct SceneContext {
     MaterialParams *materials;
     QuadLight *lights;
     ISPCTexture2D *textures;
+    // The key for each material to sort hits by before shading, null if the hits
+    // shouldn't be sorted
+    const uint32_t *material_sort_keys;
     uint32_t num_lights;
     uint32_t samples_per_pixel;
+    uint32_t num_materials;
+    // The relative error below which pixels stop taking samples, 0 if not sampling
+    // adaptively
+    float adaptive_threshold;
+    // The maximum path depth, or 0 to use MAX_PATH_DEPTH
+    uint32_t max_depth;
+};
+
+/* The accumulation and AOVs of the previous frame, reprojected into the current frame
+ * when the camera moves, see reproject_history in render_embree.ispc
+ */
+struct ReprojectionHistory {
+    ViewParams view_params;
+    const float *data;
+    const float *pixel_stats;
+    const float *reprojected_stats;
+    const float *position;
+    const float *albedo;
+    const float *normal;
 };
 
+// A region of the framebuffer to render, data, ray_stats and pixel_stats are for the
+// whole framebuffer
 struct Tile {
     uint32_t x, y;
     uint32_t width, height;
     uint32_t fb_width, fb_height;
     float *data;
     uint16_t *ray_stats;
+    // The sample statistics of each pixel for adaptive sampling, null if not sampling
+    // adaptively
+    float *pixel_stats;
+    // The reprojected history samples in each pixel and their mean luminance, null if not
+    // reprojecting
+    float *reprojected_stats;
+    // The first hit albedo and normal AOVs for denoising, null if not rendered
+    float *albedo;
+    float *normal;
+    // The first hit position AOV for reprojection, null if not rendered
+    float *position;
+    // Set by the kernels: the samples taken in the tile, and the number of its pixels
+    // which haven't converged yet
+    uint32_t num_samples;
+    uint32_t num_active_pixels;
 };
 
 }
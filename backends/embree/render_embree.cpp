@@ -1,33 +1,54 @@
 #include "render_embree.h"
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <limits>
 #include <numeric>
 #include <tbb/global_control.h>
 #include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
 #ifndef __aarch64__
 #include <pmmintrin.h>
 #include <xmmintrin.h>
 #endif
 #include <util.h>
 #include "render_embree_ispc.h"
+#include "texture_channel_mask.h"
 #include <glm/ext.hpp>
 
 static std::unique_ptr<tbb::global_control> tbb_thread_config;
 
+// Track the memory allocated by Embree, user_ptr is the counter to update
+bool embree_memory_monitor(void *user_ptr, ssize_t bytes, bool)
+{
+    *reinterpret_cast<std::atomic<int64_t> *>(user_ptr) += bytes;
+    return true;
+}
+
 RenderEmbree::RenderEmbree()
 {
 #ifndef __aarch64__
     _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
     _MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
 #endif
-    device = rtcNewDevice(nullptr);
 }
 
 RenderEmbree::~RenderEmbree()
 {
-    rtcReleaseDevice(device);
+    wait_for_mesh_builds();
+    if (bvh_build.valid()) {
+        bvh_build.wait();
+    }
+    if (tasking_benchmark && task_system && frame_id > 0) {
+        std::cout << "Tasking " << task_system->name()
+                  << " avg. tail latency: " << total_tail_latency / frame_id << "ms\n";
+    }
+    if (device) {
+        rtcReleaseDevice(device);
+    }
 }
 
 std::string RenderEmbree::name()
@@ -35,82 +56,460 @@ std::string RenderEmbree::name()
     return "Embree (w/ TBB & ISPC)";
 }
 
+bool RenderEmbree::parse_arg(const std::vector<std::string> &args, size_t &i)
+{
+    if (args[i] == "-bvh-quality") {
+        const std::string quality = args[++i];
+        if (quality == "low") {
+            bvh_settings.quality = RTC_BUILD_QUALITY_LOW;
+        } else if (quality == "medium") {
+            bvh_settings.quality = RTC_BUILD_QUALITY_MEDIUM;
+        } else if (quality == "high") {
+            bvh_settings.quality = RTC_BUILD_QUALITY_HIGH;
+        } else {
+            std::cout << "Error: Invalid BVH quality " << quality
+                      << ", must be low, medium or high\n";
+            throw std::runtime_error("Invalid BVH quality " + quality);
+        }
+        return true;
+    }
+    if (args[i] == "-tile-size") {
+        const int size = std::stoi(args[++i]);
+        if (size <= 0) {
+            std::cout << "Error: Invalid tile size " << size << ", must be positive\n";
+            throw std::runtime_error("Invalid tile size " + std::to_string(size));
+        }
+        requested_tile_size = size;
+        return true;
+    }
+    if (args[i] == "-wavefront") {
+        kernel = TraceKernel::WAVEFRONT;
+        return true;
+    }
+    if (args[i] == "-sort-hits") {
+        sort_hits = true;
+        return true;
+    }
+    if (args[i] == "-path-regeneration") {
+        kernel = TraceKernel::PATH_REGENERATION;
+        return true;
+    }
+    if (args[i] == "-tasking") {
+        scheduler = tasking::parse_scheduler(args[++i]);
+        return true;
+    }
+    if (args[i] == "-threads") {
+        const int threads = std::stoi(args[++i]);
+        if (threads <= 0) {
+            std::cout << "Error: Invalid thread count " << threads << ", must be positive\n";
+            throw std::runtime_error("Invalid thread count " + std::to_string(threads));
+        }
+        num_threads = threads;
+        return true;
+    }
+    if (args[i] == "-affinity") {
+        pin_threads = true;
+        return true;
+    }
+    if (args[i] == "-adaptive-threshold") {
+        adaptive_threshold = std::stof(args[++i]);
+        if (adaptive_threshold <= 0.f) {
+            std::cout << "Error: Invalid adaptive threshold " << adaptive_threshold
+                      << ", must be positive\n";
+            throw std::runtime_error("Invalid adaptive threshold " + args[i]);
+        }
+        return true;
+    }
+    if (args[i] == "-interactive-scale") {
+        interactive_scale = std::stof(args[++i]);
+        if (interactive_scale <= 0.f || interactive_scale > 1.f) {
+            std::cout << "Error: Invalid interactive scale " << interactive_scale
+                      << ", must be in (0, 1]\n";
+            throw std::runtime_error("Invalid interactive scale " + args[i]);
+        }
+        return true;
+    }
+    if (args[i] == "-interactive-depth") {
+        const int depth = std::stoi(args[++i]);
+        if (depth <= 0) {
+            std::cout << "Error: Invalid interactive depth " << depth
+                      << ", must be positive\n";
+            throw std::runtime_error("Invalid interactive depth " + std::to_string(depth));
+        }
+        interactive_depth = depth;
+        return true;
+    }
+    if (args[i] == "-denoise") {
+        const std::string mode = args[++i];
+#ifndef EMBREE_OIDN_ENABLED
+        std::cout << "Error: Denoising is not available, the Embree backend was built "
+                  << "without Open Image Denoise\n";
+        throw std::runtime_error("Denoising is not available");
+#endif
+        if (mode == "every") {
+            denoise = DenoiseMode::EVERY_FRAME;
+        } else if (mode == "final") {
+            denoise = DenoiseMode::FINAL_FRAME;
+        } else {
+            std::cout << "Error: Invalid denoise mode " << mode
+                      << ", must be every or final\n";
+            throw std::runtime_error("Invalid denoise mode " + mode);
+        }
+        return true;
+    }
+    if (args[i] == "-reproject") {
+        reproject = true;
+        return true;
+    }
+    if (args[i] == "-numa-replicate") {
+        numa_replicate = true;
+        return true;
+    }
+    if (args[i] == "-tasking-benchmark") {
+        tasking_benchmark = true;
+        return true;
+    }
+    if (args[i] == "-bvh-progressive") {
+        progressive_bvh = true;
+        return true;
+    }
+    if (args[i] == "-bvh-compact") {
+        bvh_settings.flags = RTCSceneFlags(bvh_settings.flags | RTC_SCENE_FLAG_COMPACT);
+        return true;
+    }
+    return false;
+}
+
+// Reallocate the buffer with the given size, without writing to the new memory
+template <typename T>
+void allocate_framebuffer(FrameBuffer<T> &buffer, const size_t size)
+{
+    FrameBuffer<T>(size).swap(buffer);
+}
+
 void RenderEmbree::initialize(const int fb_width, const int fb_height)
 {
     frame_id = 0;
+    first_frame = true;
+    total_tail_latency = 0.0;
     fb_dims = glm::ivec2(fb_width, fb_height);
     img.resize(fb_width * fb_height);
 
-    const glm::uvec2 ntiles(fb_dims.x / tile_size.x + (fb_dims.x % tile_size.x != 0 ? 1 : 0),
-                            fb_dims.y / tile_size.y + (fb_dims.y % tile_size.y != 0 ? 1 : 0));
-    tiles.resize(ntiles.x * ntiles.y);
-    ray_stats.resize(tiles.size());
-    for (size_t i = 0; i < tiles.size(); ++i) {
-        tiles[i].resize(tile_size.x * tile_size.y * 3, 0.f);
-        ray_stats[i].resize(tile_size.x * tile_size.y, 0);
+    if (!device) {
+        // The thread count limit applies to Embree's BVH builds and the render tasks
+        if (num_threads > 0) {
+            tbb_thread_config = std::make_unique<tbb::global_control>(
+                tbb::global_control::max_allowed_parallelism, num_threads);
+        }
+        std::string device_config;
+        if (num_threads > 0) {
+            device_config = "threads=" + std::to_string(num_threads);
+        }
+        if (pin_threads) {
+            device_config += device_config.empty() ? "set_affinity=1" : ",set_affinity=1";
+        }
+        device = rtcNewDevice(device_config.c_str());
+        rtcSetDeviceMemoryMonitorFunction(
+            device, embree_memory_monitor, &embree_memory_bytes);
+
+        task_system = tasking::make_task_system(scheduler, num_threads, pin_threads);
+        std::cout << "Embree tasking: " << task_system->name() << ", "
+                  << task_system->num_threads() << " threads"
+                  << (pin_threads ? " pinned" : "") << ", "
+                  << tasking::numa_nodes().size() << " NUMA node(s)\n";
+
+        // Benchmark the schedulers once at startup, not each time the framebuffer is
+        // resized
+        if (tasking_benchmark) {
+            for (const auto &scheduler : tasking::available_schedulers()) {
+                tasking::benchmark_task_system(
+                    *tasking::make_task_system(scheduler, num_threads, pin_threads));
+            }
+        }
     }
 
-#ifdef REPORT_RAY_STATS
-    num_rays.resize(tiles.size(), 0);
-#endif
+    if (requested_tile_size != 0) {
+        tile_size = glm::uvec2(requested_tile_size);
+    } else {
+        // Use the largest tile size which still gives each thread enough tiles to balance
+        // the load across the threads
+        const size_t min_tiles = 8 * task_system->num_threads();
+        tile_size = glm::uvec2(64);
+        while (tile_size.x > 16) {
+            const glm::uvec2 ntiles = num_tiles();
+            if (ntiles.x * ntiles.y >= min_tiles) {
+                break;
+            }
+            tile_size = tile_size / 2u;
+        }
+    }
+    std::cout << "Embree tile size: " << tile_size.x << "x" << tile_size.y << "\n";
+
+    const glm::uvec2 ntiles = num_tiles();
+    tile_costs.clear();
+    tile_costs.resize(ntiles.x * ntiles.y, 0.f);
+    // The framebuffers are allocated without writing to them, and zeroed by
+    // first_touch_framebuffers
+    const size_t num_pixels = size_t(fb_dims.x) * fb_dims.y;
+    allocate_framebuffer(accum_buffer, num_pixels * 3);
+    allocate_framebuffer(ray_stats, num_pixels);
+    // Reprojected pixels carry the history's samples, so the pixels' sample counts differ
+    // and are tracked in the pixel stats as for adaptive sampling
+    allocate_framebuffer(pixel_stats,
+                         adaptive_threshold > 0.f || reproject ? num_pixels * 3 : 0);
+    allocate_framebuffer(position_buffer, reproject ? num_pixels * 4 : 0);
+    allocate_framebuffer(reprojected_stats, reproject ? num_pixels * 2 : 0);
+    allocate_framebuffer(history_buffer, reproject ? accum_buffer.size() : 0);
+    allocate_framebuffer(history_pixel_stats, reproject ? pixel_stats.size() : 0);
+    allocate_framebuffer(history_reprojected_stats, reproject ? reprojected_stats.size() : 0);
+    allocate_framebuffer(history_position, reproject ? position_buffer.size() : 0);
+    const bool denoising = denoise != DenoiseMode::NONE;
+    allocate_framebuffer(albedo_buffer, denoising ? num_pixels * 3 : 0);
+    allocate_framebuffer(normal_buffer, denoising ? num_pixels * 3 : 0);
+    allocate_framebuffer(denoised_buffer, denoising ? num_pixels * 3 : 0);
+    allocate_framebuffer(history_albedo, denoising && reproject ? num_pixels * 3 : 0);
+    allocate_framebuffer(history_normal, denoising && reproject ? num_pixels * 3 : 0);
+    first_touch_framebuffers();
+
+    tile_active_pixels.clear();
+    tile_active_pixels.resize(ntiles.x * ntiles.y, 0);
+
+    if (denoising) {
+        setup_denoiser();
+    }
 }
 
-void RenderEmbree::set_scene(const Scene &scene)
+void RenderEmbree::first_touch_framebuffers()
 {
-    frame_id = 0;
+    // Each node renders the tiles with pos.y * num_nodes / height == node, see render, so
+    // whole tile rows are assigned to nodes by the same rule
+    const size_t num_nodes =
+        numa_replicate && tasking::numa_nodes().size() > 1 ? tasking::numa_nodes().size() : 1;
+    const size_t num_pixels = size_t(fb_dims.x) * fb_dims.y;
+    const auto zero_band = [&](const size_t node) {
+        for (size_t y = 0; y < fb_dims.y; y += tile_size.y) {
+            if (y * num_nodes / fb_dims.y != node) {
+                continue;
+            }
+            const size_t begin = y * fb_dims.x;
+            const size_t end = std::min(y + tile_size.y, size_t(fb_dims.y)) * fb_dims.x;
+            const auto zero_rows = [&](auto &buffer) {
+                const size_t channels = buffer.size() / num_pixels;
+                std::fill(
+                    buffer.begin() + begin * channels, buffer.begin() + end * channels, 0);
+            };
+            zero_rows(accum_buffer);
+            zero_rows(ray_stats);
+            zero_rows(pixel_stats);
+            zero_rows(position_buffer);
+            zero_rows(reprojected_stats);
+            zero_rows(history_buffer);
+            zero_rows(history_pixel_stats);
+            zero_rows(history_reprojected_stats);
+            zero_rows(history_position);
+            zero_rows(albedo_buffer);
+            zero_rows(normal_buffer);
+            zero_rows(denoised_buffer);
+            zero_rows(history_albedo);
+            zero_rows(history_normal);
+        }
+    };
+    if (num_nodes == 1) {
+        zero_band(0);
+        return;
+    }
 
-    samples_per_pixel = scene.samples_per_pixel;
+    // Pages are placed in the NUMA node of the thread which first writes them
+    std::vector<std::future<void>> fills;
+    for (size_t n = 0; n < num_nodes; ++n) {
+        fills.push_back(std::async(std::launch::async, [&, n]() {
+            tasking::pin_thread_to_numa_node(n);
+            zero_band(n);
+        }));
+    }
+    for (auto &f : fills) {
+        f.get();
+    }
+}
 
-    std::vector<std::shared_ptr<embree::TriangleMesh>> meshes;
-    for (const auto &mesh : scene.meshes) {
-        std::vector<std::shared_ptr<embree::Geometry>> geometries;
-        for (const auto &geom : mesh.geometries) {
-            geometries.push_back(std::make_shared<embree::Geometry>(
-                device, geom.vertices, geom.indices, geom.normals, geom.uvs));
+void RenderEmbree::setup_denoiser()
+{
+#ifdef EMBREE_OIDN_ENABLED
+    if (!oidn_device) {
+        oidn_device = oidn::newDevice(oidn::DeviceType::CPU);
+        if (num_threads > 0) {
+            oidn_device.set("numThreads", int(num_threads));
         }
+        oidn_device.set("setAffinity", pin_threads);
+        oidn_device.commit();
+        oidn_filter = oidn_device.newFilter("RT");
+    }
+    // The accumulated image is linear HDR, and the AOVs are averaged over the same
+    // samples as the color, so the denoiser treats them as noise free
+    oidn_filter.setImage(
+        "color", accum_buffer.data(), oidn::Format::Float3, fb_dims.x, fb_dims.y);
+    oidn_filter.setImage(
+        "albedo", albedo_buffer.data(), oidn::Format::Float3, fb_dims.x, fb_dims.y);
+    oidn_filter.setImage(
+        "normal", normal_buffer.data(), oidn::Format::Float3, fb_dims.x, fb_dims.y);
+    oidn_filter.setImage(
+        "output", denoised_buffer.data(), oidn::Format::Float3, fb_dims.x, fb_dims.y);
+    oidn_filter.set("hdr", true);
+    oidn_filter.commit();
+    oidn_color = accum_buffer.data();
+
+    const char *error = nullptr;
+    if (oidn_device.getError(error) != oidn::Error::None) {
+        std::cout << "Error: Failed to set up Open Image Denoise: " << error << "\n";
+        throw std::runtime_error(std::string("Failed to set up Open Image Denoise: ") +
+                                 error);
+    }
+#endif
+}
 
-        meshes.push_back(std::make_shared<embree::TriangleMesh>(device, geometries));
+void RenderEmbree::denoise_frame()
+{
+#ifdef EMBREE_OIDN_ENABLED
+    if (oidn_color != accum_buffer.data()) {
+        // The accumulation and AOVs were swapped with the history, rebind them
+        setup_denoiser();
+    }
+    oidn_filter.execute();
+    const char *error = nullptr;
+    if (oidn_device.getError(error) != oidn::Error::None) {
+        std::cout << "Error: Open Image Denoise failed: " << error << "\n";
+        throw std::runtime_error(std::string("Open Image Denoise failed: ") + error);
     }
+#endif
+}
+
+size_t RenderEmbree::max_instance_levels() const
+{
+    return RTC_MAX_INSTANCE_LEVEL_COUNT;
+}
+
+void RenderEmbree::set_scene(const Scene &in_scene)
+{
+    set_scene(std::make_shared<const Scene>(in_scene));
+}
+
+void RenderEmbree::set_scene(std::shared_ptr<const Scene> in_scene)
+{
+    setup_scene(in_scene, {});
+}
 
-    parameterized_meshes = scene.parameterized_meshes;
+void RenderEmbree::begin_scene()
+{
+    wait_for_mesh_builds();
+    streamed_meshes.clear();
+    release_scene_bvh();
+}
 
-    std::vector<std::shared_ptr<embree::Instance>> instances;
-    for (const auto &inst : scene.instances) {
-        const auto &pm = parameterized_meshes[inst.parameterized_mesh_id];
-        instances.push_back(std::make_shared<embree::Instance>(
-            device, meshes[pm.mesh_id], inst.transform, pm.material_ids));
+void RenderEmbree::add_mesh(const uint32_t mesh_id, const Mesh &mesh)
+{
+    // Build the mesh's BVH in the background while the rest of the scene loads. The
+    // builds run in the BVH build arena, in parallel with each other and the load
+    auto embree_mesh = make_mesh(mesh, initial_bvh_settings());
+    if (mesh_id >= streamed_meshes.size()) {
+        streamed_meshes.resize(mesh_id + 1);
+    }
+    streamed_meshes[mesh_id] = embree_mesh;
+    {
+        std::lock_guard<std::mutex> lock(mesh_build_mutex);
+        ++pending_mesh_builds;
     }
+    bvh_build_arena.enqueue([this, embree_mesh]() {
+        embree_mesh->commit();
+        std::lock_guard<std::mutex> lock(mesh_build_mutex);
+        if (--pending_mesh_builds == 0) {
+            mesh_builds_done.notify_all();
+        }
+    });
+}
 
-    scene_bvh = std::make_shared<embree::TopLevelBVH>(device, instances);
+void RenderEmbree::end_scene(std::shared_ptr<const Scene> in_scene)
+{
+    wait_for_mesh_builds();
+    std::vector<std::shared_ptr<embree::TriangleMesh>> meshes = std::move(streamed_meshes);
+    streamed_meshes.clear();
 
-    textures = scene.textures;
+    // If some meshes weren't streamed in we just build all of them
+    const bool all_streamed =
+        meshes.size() == in_scene->meshes.size() &&
+        std::all_of(meshes.begin(), meshes.end(), [](const auto &m) { return m != nullptr; });
+    if (!all_streamed) {
+        meshes.clear();
+    }
+    setup_scene(in_scene, std::move(meshes));
+}
 
-    // Linearize any sRGB textures beforehand, since we don't have fancy sRGB texture
-    // interpolation support in hardware
-    tbb::parallel_for(size_t(0), textures.size(), [&](size_t i) {
-        auto &img = textures[i];
-        if (img.color_space == LINEAR) {
-            return;
+// Get a bitmask of which of the material's parameters are textured
+uint32_t textured_params_mask(const embree::MaterialParams &p)
+{
+    const float params[] = {p.base_color.r,
+                            p.metallic,
+                            p.specular,
+                            p.roughness,
+                            p.specular_tint,
+                            p.anisotropy,
+                            p.sheen,
+                            p.sheen_tint,
+                            p.clearcoat,
+                            p.clearcoat_gloss,
+                            p.ior,
+                            p.specular_transmission};
+    uint32_t mask = 0;
+    for (size_t i = 0; i < sizeof(params) / sizeof(float); ++i) {
+        uint32_t bits;
+        std::memcpy(&bits, &params[i], sizeof(uint32_t));
+        if (IS_TEXTURED_PARAM(bits)) {
+            mask |= 1 << i;
         }
-        img.color_space = LINEAR;
-        const int convert_channels = std::min(3, img.channels);
-        tbb::parallel_for(size_t(0), size_t(img.width) * img.height, [&](size_t px) {
-            for (int c = 0; c < convert_channels; ++c) {
-                float x = img.img[px * img.channels + c] / 255.f;
-                x = srgb_to_linear(x);
-                img.img[px * img.channels + c] = glm::clamp(x * 255.f, 0.f, 255.f);
-            }
+    }
+    return mask;
+}
+
+void RenderEmbree::setup_scene(std::shared_ptr<const Scene> in_scene,
+                               std::vector<std::shared_ptr<embree::TriangleMesh>> meshes)
+{
+    // Release the previous scene's BVHs so the memory reported is only for this scene
+    release_scene_bvh();
+
+    frame_id = 0;
+    first_frame = true;
+    scene = in_scene;
+
+    samples_per_pixel = scene->samples_per_pixel;
+
+    if (progressive_bvh && bvh_settings.quality != RTC_BUILD_QUALITY_LOW) {
+        // Start rendering on a fast low quality build, while the final BVH is built in
+        // the background and swapped in by render once it's done. The background build
+        // runs in its own arena so that its tasks aren't picked up by threads waiting on
+        // the render tasks, which would stall the frame until they finish
+        scene_bvh = build_scene_bvh(initial_bvh_settings(), std::move(meshes));
+
+        bvh_build = std::async(std::launch::async, [this]() {
+            auto bvh =
+                bvh_build_arena.execute([&]() { return build_scene_bvh(bvh_settings); });
+            std::lock_guard<std::mutex> lock(pending_bvh_mutex);
+            pending_bvh = bvh;
         });
-    });
+    } else {
+        scene_bvh = build_scene_bvh(bvh_settings, std::move(meshes));
+    }
 
-    ispc_textures.reserve(textures.size());
-    std::transform(textures.begin(),
-                   textures.end(),
+    // The textures are used directly from the scene, sRGB textures are linearized when
+    // sampled in ISPC, see ISPCTexture2D
+    ispc_textures.clear();
+    ispc_textures.reserve(scene->textures.size());
+    std::transform(scene->textures.begin(),
+                   scene->textures.end(),
                    std::back_inserter(ispc_textures),
                    [](const Image &img) { return embree::ISPCTexture2D(img); });
 
-    material_params.reserve(scene.materials.size());
-    for (const auto &m : scene.materials) {
+    material_params.clear();
+    material_params.reserve(scene->materials.size());
+    for (const auto &m : scene->materials) {
         embree::MaterialParams p;
 
         p.base_color = m.base_color;
@@ -129,7 +528,292 @@ void RenderEmbree::set_scene(const Scene &scene)
         material_params.push_back(p);
     }
 
-    lights = scene.lights;
+    /* The hits are sorted by the materials' position in this order when sorting hits,
+     * which groups the materials using the same textured parameters together so that
+     * neighboring materials run the same code paths when unpacked
+     */
+    std::vector<uint32_t> material_order(material_params.size());
+    std::iota(material_order.begin(), material_order.end(), 0);
+    std::stable_sort(
+        material_order.begin(), material_order.end(), [&](const uint32_t a, const uint32_t b) {
+            return textured_params_mask(material_params[a]) <
+                   textured_params_mask(material_params[b]);
+        });
+    material_sort_keys.resize(material_params.size());
+    for (size_t i = 0; i < material_order.size(); ++i) {
+        material_sort_keys[material_order[i]] = i;
+    }
+
+    lights = scene->lights;
+
+    numa_scene_data.clear();
+    if (numa_replicate && tasking::numa_nodes().size() > 1) {
+        replicate_scene_data();
+    }
+}
+
+void RenderEmbree::replicate_scene_data()
+{
+    // Pages are placed in the NUMA node of the thread which first writes them, so each
+    // node's copy is made by a thread running on that node
+    numa_scene_data.resize(tasking::numa_nodes().size());
+    std::vector<std::future<void>> copies;
+    for (size_t n = 0; n < numa_scene_data.size(); ++n) {
+        copies.push_back(std::async(std::launch::async, [this, n]() {
+            tasking::pin_thread_to_numa_node(n);
+
+            NUMASceneData &data = numa_scene_data[n];
+            data.material_params = material_params;
+            data.material_sort_keys = material_sort_keys;
+            data.lights = lights;
+            data.textures = ispc_textures;
+            data.texture_data.resize(ispc_textures.size());
+            for (size_t i = 0; i < ispc_textures.size(); ++i) {
+                const embree::ISPCTexture2D &tex = ispc_textures[i];
+                data.texture_data[i].assign(
+                    tex.data, tex.data + size_t(tex.width) * tex.height * tex.channels);
+                data.textures[i].data = data.texture_data[i].data();
+            }
+        }));
+    }
+    for (auto &c : copies) {
+        c.get();
+    }
+
+    size_t texture_bytes = 0;
+    for (const auto &tex : numa_scene_data[0].texture_data) {
+        texture_bytes += tex.size();
+    }
+    std::cout << "Replicated scene shading data to " << numa_scene_data.size()
+              << " NUMA nodes, " << texture_bytes / (1024.f * 1024.f)
+              << "MB of textures per node\n";
+}
+
+std::string build_quality_name(const RTCBuildQuality quality)
+{
+    switch (quality) {
+    case RTC_BUILD_QUALITY_LOW:
+        return "low";
+    case RTC_BUILD_QUALITY_HIGH:
+        return "high";
+    default:
+        return "medium";
+    }
+}
+
+embree::BVHSettings RenderEmbree::initial_bvh_settings() const
+{
+    embree::BVHSettings settings = bvh_settings;
+    if (progressive_bvh) {
+        settings.quality = RTC_BUILD_QUALITY_LOW;
+    }
+    return settings;
+}
+
+void RenderEmbree::release_scene_bvh()
+{
+    // Finish any background build for the scene before releasing it
+    if (bvh_build.valid()) {
+        bvh_build.get();
+    }
+    scene_bvh = nullptr;
+    pending_bvh = nullptr;
+}
+
+void RenderEmbree::wait_for_mesh_builds()
+{
+    std::unique_lock<std::mutex> lock(mesh_build_mutex);
+    mesh_builds_done.wait(lock, [&]() { return pending_mesh_builds == 0; });
+}
+
+std::shared_ptr<embree::TriangleMesh> RenderEmbree::make_mesh(
+    const Mesh &mesh, const embree::BVHSettings &settings)
+{
+    std::vector<std::shared_ptr<embree::Geometry>> geometries;
+    for (const auto &geom : mesh.geometries) {
+        geometries.push_back(std::make_shared<embree::Geometry>(
+            device, geom.vertices, geom.indices, geom.normals, geom.uvs));
+    }
+    return std::make_shared<embree::TriangleMesh>(device, geometries, settings);
+}
+
+std::shared_ptr<embree::TopLevelBVH> RenderEmbree::build_scene_bvh(
+    const embree::BVHSettings &settings,
+    std::vector<std::shared_ptr<embree::TriangleMesh>> meshes)
+{
+    using namespace std::chrono;
+    const auto build_start = high_resolution_clock::now();
+
+    // The mesh BVHs are already built if the meshes were streamed in
+    if (meshes.empty()) {
+        meshes = build_meshes(settings);
+    }
+
+    // Instance groups are built into their own BVH the first time they're instanced, and
+    // the BVH is shared by all instances of the group
+    std::vector<std::shared_ptr<embree::TopLevelBVH>> group_bvhs(
+        scene->instance_groups.size());
+    std::function<std::vector<std::shared_ptr<embree::Instance>>(
+        const std::vector<Instance> &, const std::vector<GroupInstance> &)>
+        make_instances = [&](const std::vector<Instance> &scene_instances,
+                             const std::vector<GroupInstance> &scene_group_instances) {
+            std::vector<std::shared_ptr<embree::Instance>> instances;
+            for (const auto &inst : scene_instances) {
+                const auto &pm = scene->parameterized_meshes[inst.parameterized_mesh_id];
+                instances.push_back(std::make_shared<embree::Instance>(
+                    device, meshes[pm.mesh_id], inst.transform, pm.material_ids));
+            }
+            for (const auto &inst : scene_group_instances) {
+                auto &group_bvh = group_bvhs[inst.group_id];
+                if (!group_bvh) {
+                    const InstanceGroup &group = scene->instance_groups[inst.group_id];
+                    group_bvh = std::make_shared<embree::TopLevelBVH>(
+                        device,
+                        make_instances(group.instances, group.group_instances),
+                        settings);
+                }
+                instances.push_back(
+                    std::make_shared<embree::Instance>(device, group_bvh, inst.transform));
+            }
+            return instances;
+        };
+
+    auto bvh = std::make_shared<embree::TopLevelBVH>(
+        device, make_instances(scene->instances, scene->group_instances), settings);
+
+    const float build_time =
+        duration_cast<duration<float, std::milli>>(high_resolution_clock::now() - build_start)
+            .count();
+    std::cout << "Embree BVH build time (" << build_quality_name(settings.quality)
+              << " quality): " << build_time << "ms, Embree memory use: "
+              << embree_memory_bytes / (1024.f * 1024.f) << "MB\n";
+    return bvh;
+}
+
+uint32_t RenderEmbree::budget_samples_per_pixel() const
+{
+    // Start with one sample per pixel until there are costs to predict from
+    const float total_cost = std::accumulate(tile_costs.begin(), tile_costs.end(), 0.f);
+    if (tile_costs_spp == 0 || total_cost <= 0.f) {
+        return 1;
+    }
+    const float sample_time =
+        frame_time_scale * total_cost / (tile_costs_spp * task_system->num_threads());
+    // Limit how quickly the sample count grows, in case the prediction is off
+    const uint32_t spp = uint32_t(frame_budget_ms / sample_time);
+    return glm::clamp(spp, 1u, 2 * tile_costs_spp);
+}
+
+std::vector<TileTask> RenderEmbree::tile_grid(const glm::uvec2 &dims) const
+{
+    std::vector<TileTask> tasks;
+    const glm::uvec2 ntiles = (dims + tile_size - glm::uvec2(1)) / tile_size;
+    for (uint32_t y = 0; y < ntiles.y; ++y) {
+        for (uint32_t x = 0; x < ntiles.x; ++x) {
+            const glm::uvec2 tile_pos = glm::uvec2(x, y) * tile_size;
+            const glm::uvec2 tile_end = glm::min(tile_pos + tile_size, dims);
+            tasks.push_back(TileTask{tile_pos, tile_end - tile_pos, y * ntiles.x + x, 0.f});
+        }
+    }
+    return tasks;
+}
+
+glm::uvec2 RenderEmbree::num_tiles() const
+{
+    // Round up the number of tiles we need to run in case the
+    // framebuffer is not an even multiple of tile size
+    return glm::uvec2(fb_dims.x / tile_size.x + (fb_dims.x % tile_size.x != 0 ? 1 : 0),
+                      fb_dims.y / tile_size.y + (fb_dims.y % tile_size.y != 0 ? 1 : 0));
+}
+
+std::vector<TileTask> RenderEmbree::schedule_tiles() const
+{
+    const glm::uvec2 ntiles = num_tiles();
+
+    // Tasks expected to take more than this are split so that no single task is left
+    // running long after the others have finished. Before the first frame the costs are
+    // all 0 and nothing is split
+    const float total_cost = std::accumulate(tile_costs.begin(), tile_costs.end(), 0.f);
+    const float max_task_cost = total_cost / (4.f * task_system->num_threads());
+    // Tasks aren't split below the size of the 8x8 pixel blocks assigned to the lanes
+    const uint32_t min_task_size = 8;
+
+    std::vector<TileTask> tasks;
+    std::vector<TileTask> to_split;
+    for (uint32_t tile_id = 0; tile_id < tile_costs.size(); ++tile_id) {
+        const glm::uvec2 tile = glm::uvec2(tile_id % ntiles.x, tile_id / ntiles.x);
+        const glm::uvec2 tile_pos = tile * tile_size;
+        const glm::uvec2 tile_end = glm::min(tile_pos + tile_size, glm::uvec2(fb_dims));
+
+        // Tiles which have converged are skipped when sampling adaptively
+        if (!pixel_stats.empty() && frame_id > 0 && tile_active_pixels[tile_id] == 0) {
+            continue;
+        }
+
+        to_split.push_back(
+            TileTask{tile_pos, tile_end - tile_pos, tile_id, tile_costs[tile_id]});
+        while (!to_split.empty()) {
+            const TileTask task = to_split.back();
+            to_split.pop_back();
+            if (task.cost <= max_task_cost || task.dims.x < 2 * min_task_size ||
+                task.dims.y < 2 * min_task_size) {
+                tasks.push_back(task);
+                continue;
+            }
+            // Split the task into quarters, keeping the splits on the 8x8 blocks
+            const glm::uvec2 half = ((task.dims / 2u + min_task_size - 1u) / min_task_size) *
+                                    min_task_size;
+            for (uint32_t y = 0; y < 2; ++y) {
+                for (uint32_t x = 0; x < 2; ++x) {
+                    const glm::uvec2 offset(x * half.x, y * half.y);
+                    const glm::uvec2 dims(x == 0 ? half.x : task.dims.x - half.x,
+                                          y == 0 ? half.y : task.dims.y - half.y);
+                    to_split.push_back(TileTask{
+                        task.pos + offset, dims, task.tile_id, task.cost / 4.f});
+                }
+            }
+        }
+    }
+
+    // Start the most expensive tasks first so that the cheap ones fill in the end of the
+    // frame. Ties (e.g., on the first frame) are kept in scanline order
+    std::stable_sort(tasks.begin(), tasks.end(), [](const TileTask &a, const TileTask &b) {
+        return a.cost > b.cost;
+    });
+    return tasks;
+}
+
+std::vector<std::shared_ptr<embree::TriangleMesh>> RenderEmbree::build_meshes(
+    const embree::BVHSettings &settings)
+{
+    std::vector<std::shared_ptr<embree::TriangleMesh>> meshes(scene->meshes.size());
+    tbb::parallel_for(size_t(0), scene->meshes.size(), [&](size_t i) {
+        meshes[i] = make_mesh(scene->meshes[i], settings);
+    });
+
+    /* Build the mesh BVHs in parallel, starting with the largest meshes so that the
+     * longest builds aren't left running by themselves at the end. Each worker takes the
+     * next largest mesh left to build, and large builds are parallelized internally by
+     * Embree using the workers which are done with their meshes
+     */
+    std::vector<size_t> build_order(meshes.size());
+    std::iota(build_order.begin(), build_order.end(), 0);
+    std::sort(build_order.begin(), build_order.end(), [&](const size_t a, const size_t b) {
+        return scene->meshes[a].num_tris() > scene->meshes[b].num_tris();
+    });
+    std::atomic<size_t> next_build(0);
+    const size_t num_workers =
+        std::min(size_t(tbb::this_task_arena::max_concurrency()), build_order.size());
+    tbb::parallel_for(
+        size_t(0),
+        num_workers,
+        [&](size_t) {
+            for (size_t i = next_build++; i < build_order.size(); i = next_build++) {
+                meshes[build_order[i]]->commit();
+            }
+        },
+        tbb::simple_partitioner());
+    return meshes;
 }
 
 RenderStats RenderEmbree::render(const glm::vec3 &pos,
@@ -137,7 +821,7 @@ RenderStats RenderEmbree::render(const glm::vec3 &pos,
                                  const glm::vec3 &up,
                                  const float fovy,
                                  const bool camera_changed,
-                                 const bool)
+                                 const bool readback_framebuffer)
 {
     using namespace std::chrono;
     RenderStats stats;
@@ -146,6 +830,62 @@ RenderStats RenderEmbree::render(const glm::vec3 &pos,
         frame_id = 0;
     }
 
+    // When reprojecting, the accumulation in the last view is blended into the first frame
+    // in the new view. Otherwise while the camera is moving render a lower quality frame,
+    // which isn't accumulated
+    const bool reproject_frame = camera_changed && !first_frame && reproject;
+    const bool interactive =
+        camera_changed && !first_frame && !reproject && interactive_scale < 1.f;
+    first_frame = false;
+    if (reproject_frame) {
+        // The previous view's buffers become the history, and the new view's first frame
+        // overwrites every pixel of the buffers swapped in for it
+        std::swap(history_buffer, accum_buffer);
+        std::swap(history_pixel_stats, pixel_stats);
+        std::swap(history_reprojected_stats, reprojected_stats);
+        std::swap(history_position, position_buffer);
+        std::swap(history_albedo, albedo_buffer);
+        std::swap(history_normal, normal_buffer);
+    }
+    const glm::uvec2 render_dims =
+        interactive
+            ? glm::max(glm::uvec2(glm::vec2(fb_dims) * interactive_scale), glm::uvec2(1))
+            : fb_dims;
+    float *frame_data = accum_buffer.data();
+    uint16_t *frame_ray_stats = ray_stats.data();
+    if (interactive) {
+        interactive_buffer.resize(render_dims.x * render_dims.y * 3);
+        interactive_ray_stats.resize(render_dims.x * render_dims.y);
+        frame_data = interactive_buffer.data();
+        frame_ray_stats = interactive_ray_stats.data();
+    }
+    if (frame_id == 0) {
+        adaptive_samples_per_pixel = samples_per_pixel;
+        accumulated_samples = 0;
+        // The sample offset carries on through reprojection, so the new samples don't
+        // repeat the random numbers of the history they're blended with
+        if (!reproject_frame) {
+            accumulated_spp = 0;
+        }
+    }
+
+    uint32_t frame_spp = samples_per_pixel;
+    if (frame_budget_ms > 0.f) {
+        frame_spp = budget_samples_per_pixel();
+    } else if (!pixel_stats.empty()) {
+        frame_spp = adaptive_samples_per_pixel;
+    }
+
+    {
+        // Swap in the final BVH if its background build is done. Both BVHs are built over
+        // the same scene, so the accumulated samples are kept
+        std::lock_guard<std::mutex> lock(pending_bvh_mutex);
+        if (pending_bvh) {
+            scene_bvh = std::move(pending_bvh);
+            pending_bvh = nullptr;
+        }
+    }
+
     glm::vec2 img_plane_size;
     img_plane_size.y = 2.f * std::tan(glm::radians(0.5f * fovy));
     img_plane_size.x = img_plane_size.y * static_cast<float>(fb_dims.x) / fb_dims.y;
@@ -157,59 +897,265 @@ RenderStats RenderEmbree::render(const glm::vec3 &pos,
         -glm::normalize(glm::cross(view_params.dir_du, dir)) * img_plane_size.y;
     view_params.dir_top_left = dir - 0.5f * view_params.dir_du - 0.5f * view_params.dir_dv;
     view_params.frame_id = frame_id;
+    view_params.sample_offset = accumulated_spp;
 
     embree::SceneContext ispc_scene;
     ispc_scene.scene = scene_bvh->handle;
     ispc_scene.instances = scene_bvh->ispc_instances.data();
     ispc_scene.materials = material_params.data();
+    ispc_scene.material_sort_keys = sort_hits ? material_sort_keys.data() : nullptr;
+    ispc_scene.num_materials = material_params.size();
     ispc_scene.textures = ispc_textures.data();
     ispc_scene.lights = lights.data();
     ispc_scene.num_lights = lights.size();
-    ispc_scene.samples_per_pixel = samples_per_pixel;
+    ispc_scene.samples_per_pixel = interactive ? 1 : frame_spp;
+    ispc_scene.adaptive_threshold =
+        pixel_stats.empty() || interactive ? 0.f : adaptive_threshold;
+    ispc_scene.max_depth = interactive ? interactive_depth : 0;
 
-    // Round up the number of tiles we need to run in case the
-    // framebuffer is not an even multiple of tile size
-    const glm::uvec2 ntiles(fb_dims.x / tile_size.x + (fb_dims.x % tile_size.x != 0 ? 1 : 0),
-                            fb_dims.y / tile_size.y + (fb_dims.y % tile_size.y != 0 ? 1 : 0));
+    // The AOVs are accumulated for every full quality frame so they're ready when a frame
+    // is denoised
+    const bool render_aovs = denoise != DenoiseMode::NONE && !interactive;
+    const bool denoise_this_frame =
+        render_aovs && (denoise == DenoiseMode::EVERY_FRAME || readback_framebuffer);
+
+    // When the shading data is replicated each NUMA node's threads use their node's copy
+    std::vector<embree::SceneContext> ispc_scenes(
+        std::max(numa_scene_data.size(), size_t(1)), ispc_scene);
+    for (size_t n = 0; n < numa_scene_data.size(); ++n) {
+        NUMASceneData &data = numa_scene_data[n];
+        ispc_scenes[n].materials = data.material_params.data();
+        ispc_scenes[n].material_sort_keys =
+            sort_hits ? data.material_sort_keys.data() : nullptr;
+        ispc_scenes[n].textures = data.textures.data();
+        ispc_scenes[n].lights = data.lights.data();
+    }
+    const size_t num_nodes = ispc_scenes.size();
+
+    const std::vector<TileTask> tasks =
+        interactive ? tile_grid(render_dims) : schedule_tiles();
+    std::vector<float> task_costs(tasks.size(), 0.f);
+    std::vector<uint32_t> task_samples(tasks.size(), 0);
+    std::vector<uint32_t> task_active_pixels(tasks.size(), 0);
+#ifdef REPORT_RAY_STATS
+    num_rays.clear();
+    num_rays.resize(tasks.size(), 0);
+#endif
+
+    // Each NUMA node renders a horizontal band of the framebuffer, so the same threads
+    // write the same part of the framebuffer each frame. The tasks stay in order from
+    // most to least expensive within each band
+    std::vector<std::vector<size_t>> node_tasks(num_nodes);
+    for (size_t t = 0; t < tasks.size(); ++t) {
+        node_tasks[tasks[t].pos.y * num_nodes / render_dims.y].push_back(t);
+    }
+    std::unique_ptr<std::atomic<size_t>[]> next_task(new std::atomic<size_t>[num_nodes]);
+    for (size_t n = 0; n < num_nodes; ++n) {
+        next_task[n] = 0;
+    }
 
     uint8_t *color = reinterpret_cast<uint8_t *>(img.data());
 
-    auto start = high_resolution_clock::now();
-    tbb::parallel_for(uint32_t(0), ntiles.x * ntiles.y, [&](uint32_t tile_id) {
-        const glm::uvec2 tile = glm::uvec2(tile_id % ntiles.x, tile_id / ntiles.x);
-        const glm::uvec2 tile_pos = tile * tile_size;
-        const glm::uvec2 tile_end = glm::min(tile_pos + tile_size, fb_dims);
-        const glm::uvec2 actual_tile_dims = tile_end - tile_pos;
+    const auto render_task = [&](const size_t t, embree::SceneContext &node_scene) {
+        const auto task_start = high_resolution_clock::now();
+        const TileTask &task = tasks[t];
 
         embree::Tile ispc_tile;
-        ispc_tile.x = tile_pos.x;
-        ispc_tile.y = tile_pos.y;
-        ispc_tile.width = actual_tile_dims.x;
-        ispc_tile.height = actual_tile_dims.y;
-        ispc_tile.fb_width = fb_dims.x;
-        ispc_tile.fb_height = fb_dims.y;
-        ispc_tile.data = tiles[tile_id].data();
-        ispc_tile.ray_stats = ray_stats[tile_id].data();
-
-        ispc::trace_rays(&ispc_scene, &ispc_tile, &view_params);
-
-        ispc::tile_to_uint8(&ispc_tile, color);
+        ispc_tile.x = task.pos.x;
+        ispc_tile.y = task.pos.y;
+        ispc_tile.width = task.dims.x;
+        ispc_tile.height = task.dims.y;
+        ispc_tile.fb_width = render_dims.x;
+        ispc_tile.fb_height = render_dims.y;
+        ispc_tile.data = frame_data;
+        ispc_tile.ray_stats = frame_ray_stats;
+        ispc_tile.pixel_stats =
+            pixel_stats.empty() || interactive ? nullptr : pixel_stats.data();
+        ispc_tile.reprojected_stats = reproject ? reprojected_stats.data() : nullptr;
+        ispc_tile.albedo = render_aovs ? albedo_buffer.data() : nullptr;
+        ispc_tile.normal = render_aovs ? normal_buffer.data() : nullptr;
+        // The positions are only needed for the first frame in each view
+        ispc_tile.position = reproject && frame_id == 0 ? position_buffer.data() : nullptr;
+
+        switch (kernel) {
+        case TraceKernel::WAVEFRONT:
+            ispc::trace_rays_wavefront(&node_scene, &ispc_tile, &view_params);
+            break;
+        case TraceKernel::PATH_REGENERATION:
+            ispc::trace_rays_path_regeneration(&node_scene, &ispc_tile, &view_params);
+            break;
+        default:
+            ispc::trace_rays(&node_scene, &ispc_tile, &view_params);
+            break;
+        }
+
+        task_samples[t] = ispc_tile.num_samples;
+        task_active_pixels[t] = ispc_tile.num_active_pixels;
+
+        // Interactive frames are upscaled, and reprojected and denoised frames are
+        // converted into the framebuffer once they're done
+        if (!interactive && !reproject_frame && !denoise_this_frame) {
+            ispc::tile_to_uint8(&ispc_tile, color);
+        }
 #ifdef REPORT_RAY_STATS
-        num_rays[tile_id] = std::accumulate(
-            ray_stats[tile_id].begin(),
-            ray_stats[tile_id].end(),
-            uint64_t(0),
-            [](const uint64_t &total, const uint16_t &c) { return total + c; });
+        for (uint32_t y = task.pos.y; y < task.pos.y + task.dims.y; ++y) {
+            const uint16_t *row = frame_ray_stats + y * render_dims.x + task.pos.x;
+            num_rays[t] = std::accumulate(
+                row,
+                row + task.dims.x,
+                num_rays[t],
+                [](const uint64_t &total, const uint16_t &c) { return total + c; });
+        }
 #endif
+        task_costs[t] = duration_cast<duration<float, std::milli>>(
+                            high_resolution_clock::now() - task_start)
+                            .count();
+    };
+
+    // Each worker takes the next most expensive task left in its node's band, then helps
+    // the other nodes once its band is done
+    const size_t num_workers = std::min(task_system->num_threads(), tasks.size());
+    std::vector<high_resolution_clock::time_point> worker_end(num_workers);
+    auto start = high_resolution_clock::now();
+    task_system->parallel_for(num_workers, [&](size_t worker) {
+        const size_t node = num_nodes > 1 ? tasking::current_numa_node() % num_nodes : 0;
+        for (size_t i = 0; i < num_nodes; ++i) {
+            const size_t n = (node + i) % num_nodes;
+            const std::vector<size_t> &band = node_tasks[n];
+            for (size_t t = next_task[n]++; t < band.size(); t = next_task[n]++) {
+                render_task(band[t], ispc_scenes[node]);
+            }
+        }
+        worker_end[worker] = high_resolution_clock::now();
     });
+    // The passes over the whole framebuffer are split into bands of rows
+    const uint32_t band_rows = 16;
+    const size_t num_bands = (fb_dims.y + band_rows - 1) / band_rows;
+    const auto framebuffer_band = [&](const size_t b) {
+        embree::Tile band = {};
+        band.x = 0;
+        band.y = b * band_rows;
+        band.width = fb_dims.x;
+        band.height = std::min(band_rows, fb_dims.y - band.y);
+        band.fb_width = fb_dims.x;
+        band.fb_height = fb_dims.y;
+        band.data = accum_buffer.data();
+        band.pixel_stats = pixel_stats.data();
+        band.reprojected_stats = reproject ? reprojected_stats.data() : nullptr;
+        band.albedo = render_aovs ? albedo_buffer.data() : nullptr;
+        band.normal = render_aovs ? normal_buffer.data() : nullptr;
+        band.position = position_buffer.data();
+        return band;
+    };
+    if (reproject_frame) {
+        embree::ReprojectionHistory history;
+        history.view_params = accum_view_params;
+        history.data = history_buffer.data();
+        history.pixel_stats = history_pixel_stats.data();
+        history.reprojected_stats = history_reprojected_stats.data();
+        history.position = history_position.data();
+        history.albedo = render_aovs ? history_albedo.data() : nullptr;
+        history.normal = render_aovs ? history_normal.data() : nullptr;
+        task_system->parallel_for(num_bands, [&](size_t b) {
+            embree::Tile band = framebuffer_band(b);
+            ispc::reproject_history(&band, &history);
+            if (!denoise_this_frame) {
+                ispc::tile_to_uint8(&band, color);
+            }
+        });
+    }
+    if (denoise_this_frame) {
+        denoise_frame();
+        task_system->parallel_for(num_bands, [&](size_t b) {
+            embree::Tile band = framebuffer_band(b);
+            band.data = denoised_buffer.data();
+            ispc::tile_to_uint8(&band, color);
+        });
+    }
+    if (interactive) {
+        task_system->parallel_for(num_bands, [&](size_t b) {
+            ispc::upscale_to_uint8(frame_data,
+                                   render_dims.x,
+                                   render_dims.y,
+                                   color,
+                                   fb_dims.x,
+                                   fb_dims.y,
+                                   b * band_rows,
+                                   std::min(uint32_t(b + 1) * band_rows, fb_dims.y));
+        });
+    }
     auto end = high_resolution_clock::now();
     stats.render_time = duration_cast<nanoseconds>(end - start).count() * 1.0e-6;
 
+    if (tasking_benchmark && num_workers > 0) {
+        const auto first_end = std::min_element(worker_end.begin(), worker_end.end());
+        const auto last_end = std::max_element(worker_end.begin(), worker_end.end());
+        total_tail_latency +=
+            duration_cast<duration<double, std::milli>>(*last_end - *first_end).count();
+    }
+
 #ifdef REPORT_RAY_STATS
     const uint64_t total_rays = std::accumulate(num_rays.begin(), num_rays.end(), 0);
     stats.rays_per_second = total_rays / (stats.render_time * 1.0e-3);
 #endif
 
+    if (interactive) {
+        // The interactive frames don't update the tiles' costs or the accumulation, which
+        // restarts at full quality once the camera stops moving
+        stats.interactive_quality = true;
+        stats.render_scale = interactive_scale;
+        stats.max_path_depth = interactive_depth;
+        frame_id = 0;
+        return stats;
+    }
+
+    // The cost of split tiles is summed back into the tile for scheduling the next frame
+    std::fill(tile_costs.begin(), tile_costs.end(), 0.f);
+    for (size_t t = 0; t < tasks.size(); ++t) {
+        tile_costs[tasks[t].tile_id] += task_costs[t];
+    }
+    tile_costs_spp = frame_spp;
+    accumulated_spp += frame_spp;
+
+    // Track how far the frame time predicted from the tile costs is from the measured
+    // time, smoothed over a few frames
+    const float predicted_time = std::accumulate(tile_costs.begin(), tile_costs.end(), 0.f) /
+                                 task_system->num_threads();
+    if (predicted_time > 0.f) {
+        frame_time_scale = 0.75f * frame_time_scale +
+                           0.25f * std::max(stats.render_time / predicted_time, 1.f);
+    }
+    if (frame_budget_ms > 0.f) {
+        stats.samples_per_pixel = accumulated_spp;
+    }
+
+    if (!pixel_stats.empty()) {
+        std::fill(tile_active_pixels.begin(), tile_active_pixels.end(), 0);
+        for (size_t t = 0; t < tasks.size(); ++t) {
+            tile_active_pixels[tasks[t].tile_id] += task_active_pixels[t];
+        }
+        const uint64_t num_pixels = uint64_t(fb_dims.x) * fb_dims.y;
+        const uint64_t active_pixels =
+            std::accumulate(task_active_pixels.begin(), task_active_pixels.end(), uint64_t(0));
+        accumulated_samples +=
+            std::accumulate(task_samples.begin(), task_samples.end(), uint64_t(0));
+        stats.samples_per_pixel = double(accumulated_samples) / num_pixels;
+
+        /* The samples freed up by the converged pixels go to the pixels still being
+         * sampled, keeping the frame's sample count about the same, up to 4x the samples
+         * per pixel. With a frame budget the budget already goes to the tiles still
+         * being sampled
+         */
+        if (active_pixels > 0) {
+            adaptive_samples_per_pixel =
+                std::min(samples_per_pixel * num_pixels / active_pixels,
+                         uint64_t(4 * samples_per_pixel));
+        }
+    }
+
+    if (frame_id == 0) {
+        accum_view_params = view_params;
+    }
     ++frame_id;
 
     return stats;
@@ -1,30 +1,216 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <utility>
 #include <vector>
 #include <embree4/rtcore.h>
+#include <tbb/task_arena.h>
 #include "embree_utils.h"
 #include "material.h"
 #include "render_backend.h"
+#include "tasking.h"
+
+#ifdef EMBREE_OIDN_ENABLED
+#include <OpenImageDenoise/oidn.hpp>
+#endif
+
+/* The ISPC kernels which can be used to trace the paths
+ * MEGAKERNEL: Each lane runs its pixel's paths through to the end (trace_rays)
+ * WAVEFRONT: The tile's paths are run together one bounce at a time, with each stage
+ * run as a batch (trace_rays_wavefront)
+ * PATH_REGENERATION: Lanes start the next sample as soon as their path ends
+ * (trace_rays_path_regeneration)
+ */
+enum class TraceKernel { MEGAKERNEL, WAVEFRONT, PATH_REGENERATION };
+
+/* Which frames are denoised with Open Image Denoise
+ * EVERY_FRAME: Every full quality frame is denoised
+ * FINAL_FRAME: Only frames which are read back to be saved are denoised, e.g., the last
+ * frame when benchmarking
+ */
+enum class DenoiseMode { NONE, EVERY_FRAME, FINAL_FRAME };
+
+// A region of the framebuffer rendered by one task, either a tile or part of a tile
+struct TileTask {
+    glm::uvec2 pos;
+    glm::uvec2 dims;
+    uint32_t tile_id;
+    // The estimated render time of the task in ms, based on the previous frame
+    float cost;
+};
+
+/* A copy of the scene data read while shading, allocated in a NUMA node's memory so the
+ * node's threads don't read it from another node's memory
+ */
+struct NUMASceneData {
+    std::vector<embree::MaterialParams> material_params;
+    std::vector<uint32_t> material_sort_keys;
+    std::vector<QuadLight> lights;
+    std::vector<std::vector<uint8_t>> texture_data;
+    std::vector<embree::ISPCTexture2D> textures;
+};
+
+/* An allocator which default initializes the elements, so resizing a vector of a trivial
+ * type doesn't write to the new memory. Framebuffers use it so that their pages are placed
+ * in the NUMA node of the thread which renders them, see first_touch_framebuffers
+ */
+template <typename T>
+struct DefaultInitAllocator : std::allocator<T> {
+    template <typename U>
+    struct rebind {
+        using other = DefaultInitAllocator<U>;
+    };
+
+    using std::allocator<T>::allocator;
+
+    template <typename U>
+    void construct(U *p)
+    {
+        ::new (static_cast<void *>(p)) U;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U *p, Args &&... args)
+    {
+        ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+};
+
+template <typename T>
+using FrameBuffer = std::vector<T, DefaultInitAllocator<T>>;
 
 struct RenderEmbree : RenderBackend {
-    RTCDevice device;
+    // The device is created by initialize, after the thread options have been parsed
+    RTCDevice device = 0;
     glm::uvec2 fb_dims;
 
-    // TODO: should take scene as shared ptr and keep ref to it,
-    std::vector<ParameterizedMesh> parameterized_meshes;
+    embree::BVHSettings bvh_settings;
+    // Render on a low quality BVH while the final BVH is built in the background
+    bool progressive_bvh = false;
+    // The ISPC kernel used to trace the paths, see render_embree.ispc
+    TraceKernel kernel = TraceKernel::MEGAKERNEL;
+    // Sort the hits by material before shading them in the wavefront kernel
+    bool sort_hits = false;
+    // The task system the tiles are rendered on, see tasking.h. It's created by
+    // initialize with the scheduler, thread count and affinity set
+    tasking::Scheduler scheduler = tasking::Scheduler::TBB;
+    std::unique_ptr<tasking::TaskSystem> task_system;
+    // The number of threads used by Embree and the task system, or 0 to use all of them
+    size_t num_threads = 0;
+    // Pin Embree's and the task system's threads to CPUs
+    bool pin_threads = false;
+    // Copy the scene's shading data into each NUMA node and render a band of the
+    // framebuffer on each node, see NUMASceneData
+    bool numa_replicate = false;
+    // The relative error below which pixels stop taking samples, 0 to disable adaptive
+    // sampling
+    float adaptive_threshold = 0.f;
+    // While the camera is moving the frames are rendered at this fraction of the
+    // framebuffer resolution with paths of at most interactive_depth bounces, and
+    // upscaled into the framebuffer. Once it stops the accumulation restarts at full
+    // quality
+    float interactive_scale = 0.5f;
+    uint32_t interactive_depth = 2;
+    // The first frame of a scene is rendered at full quality, since the camera only
+    // changed because it was set up
+    bool first_frame = true;
+    DenoiseMode denoise = DenoiseMode::NONE;
+    // When the camera moves, reproject the accumulation into the new view and blend it
+    // with the new samples instead of restarting it. This replaces the interactive
+    // quality frames
+    bool reproject = false;
+    // Benchmark the task systems and report the render loop's tail latency
+    bool tasking_benchmark = false;
+    // The time from the first to the last worker finishing in each frame, summed over the
+    // frames rendered, in ms
+    double total_tail_latency = 0.0;
+    // Bytes currently allocated by Embree, tracked through the device's memory monitor
+    std::atomic<int64_t> embree_memory_bytes{0};
+
+    // The scene's textures are used in place, so we keep the scene alive
+    std::shared_ptr<const Scene> scene;
     std::shared_ptr<embree::TopLevelBVH> scene_bvh;
 
+    // The final BVH, once its background build is done when using progressive_bvh
+    std::mutex pending_bvh_mutex;
+    std::shared_ptr<embree::TopLevelBVH> pending_bvh;
+    tbb::task_arena bvh_build_arena;
+    std::future<void> bvh_build;
+
+    // The mesh BVHs built in the background as the meshes are passed in while the scene's
+    // textures are decoded
+    std::vector<std::shared_ptr<embree::TriangleMesh>> streamed_meshes;
+    std::mutex mesh_build_mutex;
+    std::condition_variable mesh_builds_done;
+    size_t pending_mesh_builds = 0;
+
     std::vector<embree::MaterialParams> material_params;
+    // The key to sort hits on each material by, see sort_hits
+    std::vector<uint32_t> material_sort_keys;
     std::vector<QuadLight> lights;
-    std::vector<Image> textures;
     std::vector<embree::ISPCTexture2D> ispc_textures;
+    // The copy of the shading data for each NUMA node, empty if not replicated
+    std::vector<NUMASceneData> numa_scene_data;
 
     uint32_t frame_id = 0;
+    // The tile size set with -tile-size, or 0 to pick one based on the framebuffer size
+    uint32_t requested_tile_size = 0;
     glm::uvec2 tile_size = glm::uvec2(64);
-    std::vector<std::vector<float>> tiles;
-    std::vector<std::vector<uint16_t>> ray_stats;
+    // The render time of each tile in the last frame in ms, used to schedule the next
+    std::vector<float> tile_costs;
+    FrameBuffer<float> accum_buffer;
+    FrameBuffer<uint16_t> ray_stats;
+    // The first hit albedo and normal AOVs and the denoised image, when denoising
+    FrameBuffer<float> albedo_buffer;
+    FrameBuffer<float> normal_buffer;
+    FrameBuffer<float> denoised_buffer;
+#ifdef EMBREE_OIDN_ENABLED
+    oidn::DeviceRef oidn_device;
+    oidn::FilterRef oidn_filter;
+    // The color buffer the filter was set up with, which moves when reprojecting
+    const float *oidn_color = nullptr;
+#endif
+    // The first hit position AOV of the view the accumulation is in, and the view, when
+    // reprojecting
+    FrameBuffer<float> position_buffer;
+    embree::ViewParams accum_view_params;
+    // The number of reprojected history samples blended into each pixel and their mean
+    // luminance, which are kept out of the pixel stats
+    FrameBuffer<float> reprojected_stats;
+    /* The accumulation, pixel stats and AOVs of the previous view being reprojected. The
+     * first frame in a view overwrites every pixel, so the buffers are swapped with the
+     * current ones when the view changes
+     */
+    FrameBuffer<float> history_buffer;
+    FrameBuffer<float> history_pixel_stats;
+    FrameBuffer<float> history_reprojected_stats;
+    FrameBuffer<float> history_position;
+    FrameBuffer<float> history_albedo;
+    FrameBuffer<float> history_normal;
+    // The frame and ray stats for the frames rendered at interactive quality
+    std::vector<float> interactive_buffer;
+    std::vector<uint16_t> interactive_ray_stats;
+    // The sample count, frame count and variance estimate of each pixel when sampling
+    // adaptively or reprojecting, see accumulate_pixel in render_embree.ispc
+    FrameBuffer<float> pixel_stats;
+    // The pixels in each tile which hadn't converged after the last frame. Tiles with
+    // none left aren't rendered
+    std::vector<uint32_t> tile_active_pixels;
+    // The samples each unconverged pixel takes this frame when sampling adaptively
+    uint32_t adaptive_samples_per_pixel = 1;
+    // The samples accumulated in the framebuffer since the accumulation was reset
+    uint64_t accumulated_samples = 0;
+    // The samples per pixel taken by the frames since the accumulation was reset
+    uint32_t accumulated_spp = 0;
+    // The samples per pixel the tile costs were measured with
+    uint32_t tile_costs_spp = 0;
+    // The ratio of the measured frame time to the frame time predicted from the tile
+    // costs, which accounts for load imbalance and scheduling overhead
+    float frame_time_scale = 1.f;
 #ifdef REPORT_RAY_STATS
     std::vector<uint64_t> num_rays;
 #endif
@@ -33,12 +219,76 @@ struct RenderEmbree : RenderBackend {
     ~RenderEmbree();
 
     std::string name() override;
+    bool parse_arg(const std::vector<std::string> &args, size_t &i) override;
     void initialize(const int fb_width, const int fb_height) override;
+    size_t max_instance_levels() const override;
     void set_scene(const Scene &scene) override;
+    void set_scene(std::shared_ptr<const Scene> scene) override;
+    void begin_scene() override;
+    void add_mesh(const uint32_t mesh_id, const Mesh &mesh) override;
+    void end_scene(std::shared_ptr<const Scene> scene) override;
     RenderStats render(const glm::vec3 &pos,
                        const glm::vec3 &dir,
                        const glm::vec3 &up,
                        const float fovy,
                        const bool camera_changed,
                        const bool readback_framebuffer) override;
+
+private:
+    // Set up the scene, using the mesh BVHs passed if they're already built
+    void setup_scene(std::shared_ptr<const Scene> scene,
+                     std::vector<std::shared_ptr<embree::TriangleMesh>> meshes);
+
+    // The settings to build the BVH used for the first frames, see progressive_bvh
+    embree::BVHSettings initial_bvh_settings() const;
+
+    // Copy the scene's shading data into each NUMA node, see numa_replicate
+    void replicate_scene_data();
+
+    /* Zero the framebuffers, with each NUMA node's band of rows written by a thread on the
+     * node when the image is split between the nodes, so the band's pages are placed in
+     * the memory of the node which renders it
+     */
+    void first_touch_framebuffers();
+
+    // Wait for any background build to finish and release the scene's BVHs
+    void release_scene_bvh();
+
+    void wait_for_mesh_builds();
+
+    std::shared_ptr<embree::TriangleMesh> make_mesh(const Mesh &mesh,
+                                                    const embree::BVHSettings &settings);
+
+    // Build the BVHs for all the scene's meshes
+    std::vector<std::shared_ptr<embree::TriangleMesh>> build_meshes(
+        const embree::BVHSettings &settings);
+
+    /* Build the instance group and top-level BVHs for the scene, along with the mesh BVHs
+     * if meshes is empty
+     */
+    std::shared_ptr<embree::TopLevelBVH> build_scene_bvh(
+        const embree::BVHSettings &settings,
+        std::vector<std::shared_ptr<embree::TriangleMesh>> meshes = {});
+
+    // The number of tiles covering the framebuffer on each axis
+    glm::uvec2 num_tiles() const;
+
+    /* Split the framebuffer into the tasks to render for the frame, ordered from the
+     * most to least expensive based on the tiles' render times in the last frame.
+     * Tiles which took a large part of the frame are split into smaller tasks
+     */
+    std::vector<TileTask> schedule_tiles() const;
+
+    // Set up the denoising filter for the framebuffer's accumulation and AOV buffers
+    void setup_denoiser();
+
+    // Denoise the accumulation buffer into denoised_buffer
+    void denoise_frame();
+
+    // Split an image of the dimensions into tile_size tiles, for the interactive frames
+    std::vector<TileTask> tile_grid(const glm::uvec2 &dims) const;
+
+    // Pick the samples per pixel to take this frame to fit in frame_budget_ms, predicted
+    // from the tiles' costs in the last frame
+    uint32_t budget_samples_per_pixel() const;
 };
@@ -0,0 +1,524 @@
+#include "tasking.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
+
+#ifdef TASKING_OPENMP_ENABLED
+#include <omp.h>
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace tasking {
+
+// Collects the first exception thrown by the tasks of a loop to rethrow after the loop
+class TaskErrors {
+    std::mutex mutex;
+    std::exception_ptr error = nullptr;
+
+public:
+    void run(const std::function<void(size_t)> &fn, const size_t i)
+    {
+        try {
+            fn(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+
+    void rethrow()
+    {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+class TBBTaskSystem : public TaskSystem {
+    // Pins the arena's worker threads as they join the arena
+    class ThreadPinner : public tbb::task_scheduler_observer {
+    public:
+        ThreadPinner(tbb::task_arena &arena) : tbb::task_scheduler_observer(arena)
+        {
+            observe(true);
+        }
+
+        void on_scheduler_entry(bool is_worker) override
+        {
+            if (is_worker) {
+                pin_thread(tbb::this_task_arena::current_thread_index());
+            }
+        }
+    };
+
+    tbb::task_arena arena;
+    std::unique_ptr<ThreadPinner> pinner;
+
+public:
+    TBBTaskSystem(const size_t num_threads, const bool pin_threads)
+        : arena(num_threads > 0 ? int(num_threads) : int(tbb::task_arena::automatic))
+    {
+        if (pin_threads) {
+            arena.initialize();
+            pinner = std::make_unique<ThreadPinner>(arena);
+        }
+    }
+
+    std::string name() const override
+    {
+        return "tbb";
+    }
+
+    size_t num_threads() const override
+    {
+        return const_cast<tbb::task_arena &>(arena).max_concurrency();
+    }
+
+    void parallel_for(const size_t n, const std::function<void(size_t)> &fn) override
+    {
+        arena.execute([&]() {
+            tbb::parallel_for(
+                size_t(0), n, [&](size_t i) { fn(i); }, tbb::simple_partitioner());
+        });
+    }
+};
+
+#ifdef TASKING_OPENMP_ENABLED
+class OpenMPTaskSystem : public TaskSystem {
+    size_t threads;
+    bool pin_threads;
+
+public:
+    OpenMPTaskSystem(const size_t num_threads, const bool pin_threads)
+        : threads(num_threads > 0 ? num_threads : omp_get_max_threads()),
+          pin_threads(pin_threads)
+    {
+    }
+
+    std::string name() const override
+    {
+        return "openmp";
+    }
+
+    size_t num_threads() const override
+    {
+        return threads;
+    }
+
+    void parallel_for(const size_t n, const std::function<void(size_t)> &fn) override
+    {
+        // Exceptions can't leave the OpenMP loop, so they're rethrown after it
+        TaskErrors errors;
+#pragma omp parallel num_threads(threads)
+        {
+            // OpenMP reuses its threads between loops, so each is only pinned once
+            static thread_local int pinned_index = -1;
+            const int thread = omp_get_thread_num();
+            if (pin_threads && thread != 0 && thread != pinned_index) {
+                pin_thread(thread);
+                pinned_index = thread;
+            }
+#pragma omp for schedule(dynamic, 1)
+            for (int64_t i = 0; i < int64_t(n); ++i) {
+                errors.run(fn, i);
+            }
+        }
+        errors.rethrow();
+    }
+};
+#endif
+
+/* A pool of persistent threads which run parallel loops by work stealing. The loop's
+ * indices are split evenly into a range for each thread (the calling thread takes the
+ * first), and threads take indices from the front of their own range. Once its range is
+ * empty a thread steals the back half of another thread's range, so threads which get
+ * the cheap work end up taking work from the threads with the expensive work. Loops
+ * run one at a time, concurrent calls to parallel_for wait for the running loop.
+ */
+class WorkStealingPool : public TaskSystem {
+    // A thread's range of indices [begin, end), packed into one atomic as
+    // (end << 32) | begin so the owner and thieves can update it with a single CAS. The
+    // ranges are padded to a cache line so threads don't contend on each other's ranges
+    struct WorkRange {
+        std::atomic<uint64_t> range{0};
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    std::vector<std::thread> threads;
+    std::unique_ptr<WorkRange[]> ranges;
+
+    std::mutex loop_mutex;
+    std::mutex mutex;
+    std::condition_variable loop_ready;
+    std::condition_variable loop_done;
+    const std::function<void(size_t)> *loop_fn = nullptr;
+    TaskErrors *loop_errors = nullptr;
+    uint64_t loop_id = 0;
+    size_t threads_running = 0;
+    bool exiting = false;
+
+public:
+    WorkStealingPool(const size_t num_threads, const bool pin_threads)
+        : ranges(new WorkRange[num_threads])
+    {
+        for (size_t i = 1; i < num_threads; ++i) {
+            threads.emplace_back([this, i, pin_threads]() {
+                if (pin_threads) {
+                    pin_thread(i);
+                }
+                worker(i);
+            });
+        }
+    }
+
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            exiting = true;
+        }
+        loop_ready.notify_all();
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+
+    std::string name() const override
+    {
+        return "pool";
+    }
+
+    size_t num_threads() const override
+    {
+        return threads.size() + 1;
+    }
+
+    void parallel_for(const size_t n, const std::function<void(size_t)> &fn) override
+    {
+        if (n == 0) {
+            return;
+        }
+        if (n > std::numeric_limits<uint32_t>::max()) {
+            throw std::runtime_error("WorkStealingPool loops are limited to 2^32 indices");
+        }
+        std::lock_guard<std::mutex> loop_lock(loop_mutex);
+
+        const size_t nthreads = num_threads();
+        for (size_t i = 0; i < nthreads; ++i) {
+            ranges[i].range = pack_range(n * i / nthreads, n * (i + 1) / nthreads);
+        }
+
+        TaskErrors errors;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            loop_fn = &fn;
+            loop_errors = &errors;
+            threads_running = threads.size();
+            ++loop_id;
+        }
+        loop_ready.notify_all();
+
+        run_loop(0, fn, errors);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        loop_done.wait(lock, [&]() { return threads_running == 0; });
+        loop_fn = nullptr;
+        loop_errors = nullptr;
+        lock.unlock();
+
+        errors.rethrow();
+    }
+
+private:
+    static uint64_t pack_range(const uint64_t begin, const uint64_t end)
+    {
+        return (end << 32) | begin;
+    }
+
+    void worker(const size_t id)
+    {
+        uint64_t last_loop = 0;
+        while (true) {
+            const std::function<void(size_t)> *fn = nullptr;
+            TaskErrors *errors = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                loop_ready.wait(lock, [&]() { return exiting || loop_id != last_loop; });
+                if (exiting) {
+                    return;
+                }
+                last_loop = loop_id;
+                fn = loop_fn;
+                errors = loop_errors;
+            }
+
+            run_loop(id, *fn, *errors);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--threads_running == 0) {
+                loop_done.notify_one();
+            }
+        }
+    }
+
+    void run_loop(const size_t id, const std::function<void(size_t)> &fn, TaskErrors &errors)
+    {
+        size_t i = 0;
+        while (take(id, i) || steal(id, i)) {
+            errors.run(fn, i);
+        }
+    }
+
+    // Take the next index from the front of the thread's own range
+    bool take(const size_t id, size_t &i)
+    {
+        std::atomic<uint64_t> &range = ranges[id].range;
+        uint64_t r = range.load();
+        while (true) {
+            const uint64_t begin = r & 0xffffffff;
+            const uint64_t end = r >> 32;
+            if (begin >= end) {
+                return false;
+            }
+            if (range.compare_exchange_weak(r, pack_range(begin + 1, end))) {
+                i = begin;
+                return true;
+            }
+        }
+    }
+
+    /* Steal the back half of another thread's range, taking its first index and making
+     * the rest the thread's own range. Returns false if there's no work left to steal
+     */
+    bool steal(const size_t id, size_t &i)
+    {
+        const size_t nthreads = num_threads();
+        for (size_t offset = 1; offset < nthreads; ++offset) {
+            std::atomic<uint64_t> &victim = ranges[(id + offset) % nthreads].range;
+            uint64_t r = victim.load();
+            while (true) {
+                const uint64_t begin = r & 0xffffffff;
+                const uint64_t end = r >> 32;
+                if (begin >= end) {
+                    break;
+                }
+                const uint64_t mid = begin + (end - begin) / 2;
+                if (victim.compare_exchange_weak(r, pack_range(begin, mid))) {
+                    ranges[id].range = pack_range(mid + 1, end);
+                    i = mid;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+};
+
+std::vector<Scheduler> available_schedulers()
+{
+    return {Scheduler::TBB,
+#ifdef TASKING_OPENMP_ENABLED
+            Scheduler::OPENMP,
+#endif
+            Scheduler::POOL};
+}
+
+Scheduler parse_scheduler(const std::string &name)
+{
+    if (name == "tbb") {
+        return Scheduler::TBB;
+    }
+    if (name == "pool") {
+        return Scheduler::POOL;
+    }
+#ifdef TASKING_OPENMP_ENABLED
+    if (name == "openmp") {
+        return Scheduler::OPENMP;
+    }
+#else
+    if (name == "openmp") {
+        std::cout << "Error: OpenMP tasking is not available, the Embree backend was "
+                  << "built without OpenMP\n";
+        throw std::runtime_error("OpenMP tasking is not available");
+    }
+#endif
+    std::cout << "Error: Invalid tasking scheduler " << name
+              << ", must be tbb, openmp or pool\n";
+    throw std::runtime_error("Invalid tasking scheduler " + name);
+}
+
+std::unique_ptr<TaskSystem> make_task_system(const Scheduler scheduler,
+                                             const size_t num_threads,
+                                             const bool pin_threads)
+{
+    switch (scheduler) {
+#ifdef TASKING_OPENMP_ENABLED
+    case Scheduler::OPENMP:
+        return std::make_unique<OpenMPTaskSystem>(num_threads, pin_threads);
+#endif
+    case Scheduler::POOL:
+        return std::make_unique<WorkStealingPool>(
+            num_threads > 0 ? num_threads
+                            : std::max(size_t(std::thread::hardware_concurrency()), size_t(1)),
+            pin_threads);
+    default:
+        return std::make_unique<TBBTaskSystem>(num_threads, pin_threads);
+    }
+}
+
+// Read the CPUs in each NUMA node from sysfs. Nodes without CPUs are skipped
+std::vector<std::vector<int>> read_numa_nodes()
+{
+    std::vector<std::vector<int>> nodes;
+#ifdef __linux__
+    // Node IDs aren't necessarily contiguous, so we check all the possible IDs
+    for (int node = 0; node < 1024; ++node) {
+        std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) +
+                              "/cpulist");
+        if (!cpulist) {
+            continue;
+        }
+        // The CPU list is a comma separated list of CPUs and ranges of CPUs, e.g. 0-3,8-11
+        std::vector<int> cpus;
+        std::string range;
+        while (std::getline(cpulist, range, ',')) {
+            if (range.find_first_of("0123456789") == std::string::npos) {
+                continue;
+            }
+            const size_t dash = range.find('-');
+            const int first = std::stoi(range.substr(0, dash));
+            const int last =
+                dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        if (!cpus.empty()) {
+            nodes.push_back(cpus);
+        }
+    }
+#endif
+    if (nodes.empty()) {
+        std::vector<int> cpus(std::max(std::thread::hardware_concurrency(), 1u));
+        std::iota(cpus.begin(), cpus.end(), 0);
+        nodes.push_back(cpus);
+    }
+    return nodes;
+}
+
+const std::vector<std::vector<int>> &numa_nodes()
+{
+    static const std::vector<std::vector<int>> nodes = read_numa_nodes();
+    return nodes;
+}
+
+size_t current_numa_node()
+{
+#ifdef __linux__
+    // The NUMA node of each CPU
+    static const std::vector<size_t> cpu_nodes = []() {
+        std::vector<size_t> cpu_nodes;
+        const auto &nodes = numa_nodes();
+        for (size_t n = 0; n < nodes.size(); ++n) {
+            for (const int cpu : nodes[n]) {
+                if (size_t(cpu) >= cpu_nodes.size()) {
+                    cpu_nodes.resize(cpu + 1, 0);
+                }
+                cpu_nodes[cpu] = n;
+            }
+        }
+        return cpu_nodes;
+    }();
+    const int cpu = sched_getcpu();
+    if (cpu >= 0 && size_t(cpu) < cpu_nodes.size()) {
+        return cpu_nodes[cpu];
+    }
+#endif
+    return 0;
+}
+
+// Set the affinity of the calling thread to the CPUs
+void set_thread_affinity(const std::vector<int> &cpus)
+{
+#ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (const int cpu : cpus) {
+        CPU_SET(cpu, &cpu_set);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set);
+#elif defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (const int cpu : cpus) {
+        if (cpu < int(sizeof(DWORD_PTR) * 8)) {
+            mask |= DWORD_PTR(1) << cpu;
+        }
+    }
+    if (mask != 0) {
+        SetThreadAffinityMask(GetCurrentThread(), mask);
+    }
+#else
+    (void)cpus;
+#endif
+}
+
+void pin_thread(const size_t thread_index)
+{
+    const auto &nodes = numa_nodes();
+    const std::vector<int> &node = nodes[thread_index % nodes.size()];
+    set_thread_affinity({node[(thread_index / nodes.size()) % node.size()]});
+}
+
+void pin_thread_to_numa_node(const size_t node)
+{
+    set_thread_affinity(numa_nodes()[node]);
+}
+
+void benchmark_task_system(TaskSystem &tasks)
+{
+    using namespace std::chrono;
+    const size_t num_tasks = 1 << 20;
+    const size_t num_loops = 1000;
+
+    std::atomic<size_t> counter(0);
+    auto start = steady_clock::now();
+    tasks.parallel_for(num_tasks, [&](size_t) { ++counter; });
+    const float task_time =
+        duration_cast<duration<float, std::nano>>(steady_clock::now() - start).count() /
+        num_tasks;
+
+    start = steady_clock::now();
+    for (size_t i = 0; i < num_loops; ++i) {
+        tasks.parallel_for(tasks.num_threads(), [&](size_t) { ++counter; });
+    }
+    const float loop_time =
+        duration_cast<duration<float, std::micro>>(steady_clock::now() - start).count() /
+        num_loops;
+
+    std::cout << "Tasking " << tasks.name() << " (" << tasks.num_threads()
+              << " threads): " << task_time << "ns per task, " << loop_time
+              << "us per loop\n";
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tasking {
+
+/* The schedulers the backend's parallel loops can be run on
+ * TBB: TBB's parallel_for, sharing TBB's threads with Embree
+ * OPENMP: An OpenMP parallel for with dynamic scheduling, if built with OpenMP
+ * POOL: The in-tree work stealing thread pool, see WorkStealingPool
+ */
+enum class Scheduler { TBB, OPENMP, POOL };
+
+struct TaskSystem {
+    virtual ~TaskSystem() {}
+
+    virtual std::string name() const = 0;
+
+    // The number of threads the loops are run across
+    virtual size_t num_threads() const = 0;
+
+    /* Run fn(i) for each i in [0, n) in parallel and wait for them to finish. Indices are
+     * handed out one at a time, so this is meant for coarse grained work items. If any
+     * call to fn throws, the first exception thrown is rethrown once the loop has finished
+     */
+    virtual void parallel_for(const size_t n, const std::function<void(size_t)> &fn) = 0;
+};
+
+// The schedulers which are available in this build
+std::vector<Scheduler> available_schedulers();
+
+// Parse the scheduler name (tbb, openmp or pool), throws if it isn't available
+Scheduler parse_scheduler(const std::string &name);
+
+/* Make a task system running on num_threads threads, or on all hardware threads if 0.
+ * If pin_threads is set the task system's threads are pinned to CPUs, see pin_thread.
+ * The thread calling parallel_for is never pinned
+ */
+std::unique_ptr<TaskSystem> make_task_system(const Scheduler scheduler,
+                                             const size_t num_threads = 0,
+                                             const bool pin_threads = false);
+
+// The CPUs in each NUMA node. On systems without NUMA information this is one node
+const std::vector<std::vector<int>> &numa_nodes();
+
+// The NUMA node of the CPU the calling thread is running on
+size_t current_numa_node();
+
+/* Pin the calling thread to the CPU for the thread index. Thread indices are spread
+ * round-robin across the NUMA nodes so that a task system using fewer threads than
+ * there are CPUs still runs on every node
+ */
+void pin_thread(const size_t thread_index);
+
+// Pin the calling thread to the CPUs in the NUMA node
+void pin_thread_to_numa_node(const size_t node);
+
+/* Measure the scheduling overhead of the task system and print the results: the time
+ * per task when running many empty tasks, and the time to run a loop of one empty task
+ * per thread, which is the fixed cost of starting and finishing a parallel loop
+ */
+void benchmark_task_system(TaskSystem &tasks);
+
+}
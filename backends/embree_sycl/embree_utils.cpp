@@ -9,10 +9,10 @@ namespace embree {
 
 Geometry::Geometry(RTCDevice &device,
                    sycl::queue &sycl_queue,
-                   const std::vector<glm::vec3> &verts,
-                   const std::vector<glm::uvec3> &indices,
-                   const std::vector<glm::vec3> &normals,
-                   const std::vector<glm::vec2> &uvs)
+                   const GeometryBuffer<glm::vec3> &verts,
+                   const GeometryBuffer<glm::uvec3> &indices,
+                   const GeometryBuffer<glm::vec3> &normals,
+                   const GeometryBuffer<glm::vec2> &uvs)
     : n_vertices(verts.size()),
       vertex_buf(verts.begin(),
                  verts.end(),
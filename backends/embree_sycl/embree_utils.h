@@ -6,6 +6,7 @@
 #include <utility>
 #include <vector>
 #include <embree4/rtcore.h>
+#include "../../util/geometry_buffer.h"
 #include "../../util/lights.h"
 #include "material.h"
 #include <glm/glm.hpp>
@@ -42,10 +43,10 @@ struct Geometry {
 
     Geometry(RTCDevice &device,
              sycl::queue &sycl_queue,
-             const std::vector<glm::vec3> &verts,
-             const std::vector<glm::uvec3> &indices,
-             const std::vector<glm::vec3> &normals,
-             const std::vector<glm::vec2> &uvs);
+             const GeometryBuffer<glm::vec3> &verts,
+             const GeometryBuffer<glm::uvec3> &indices,
+             const GeometryBuffer<glm::vec3> &normals,
+             const GeometryBuffer<glm::vec2> &uvs);
 
     ~Geometry();
 
@@ -105,11 +105,12 @@ void RenderEmbree::set_scene(const Scene &scene)
         }
         img.color_space = LINEAR;
         const int convert_channels = std::min(3, img.channels);
+        uint8_t *texels = img.img.mutable_data();
         tbb::parallel_for(size_t(0), size_t(img.width) * img.height, [&](size_t px) {
             for (int c = 0; c < convert_channels; ++c) {
-                float x = img.img[px * img.channels + c] / 255.f;
+                float x = texels[px * img.channels + c] / 255.f;
                 x = srgb_to_linear(x);
-                img.img[px * img.channels + c] = glm::clamp(x * 255.f, 0.f, 255.f);
+                texels[px * img.channels + c] = glm::clamp(x * 255.f, 0.f, 255.f);
             }
         });
     });
@@ -121,7 +122,7 @@ void RenderEmbree::set_scene(const Scene &scene)
         // Upload the data to the GPU to swap the data ptr for a device memory
         auto gpu_data = std::make_shared<embree::Buffer>(
             img.img.size(), embree::MemorySpace::DEVICE, sycl_queue);
-        gpu_data->upload(img.img, sycl_queue);
+        gpu_data->upload(img.img.data(), img.img.size(), sycl_queue);
         texture_data.push_back(gpu_data);
 
         ispc_textures.emplace_back(img,
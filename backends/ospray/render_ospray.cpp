@@ -4,7 +4,6 @@
 #include <iostream>
 #include <limits>
 #include <numeric>
-#include <tbb/parallel_for.h>
 #include "texture_channel_mask.h"
 #include "util.h"
 #include <glm/ext.hpp>
@@ -71,37 +70,27 @@ void RenderOSPRay::initialize(const int fb_width, const int fb_height)
 }
 
 void RenderOSPRay::set_scene(const Scene &in_scene)
+{
+    set_scene(std::make_shared<const Scene>(in_scene));
+}
+
+void RenderOSPRay::set_scene(std::shared_ptr<const Scene> in_scene)
 {
     ospResetAccumulation(fb);
 
-    // TODO: should take scene as shared ptr
     scene = in_scene;
 
-    // Linearize any sRGB textures beforehand, since we don't have fancy sRGB texture
-    // interpolation support in hardware
-    tbb::parallel_for(size_t(0), scene.textures.size(), [&](size_t i) {
-        auto &img = scene.textures[i];
-        if (img.color_space == LINEAR) {
-            return;
-        }
-        img.color_space = LINEAR;
-        const int convert_channels = std::min(3, img.channels);
-        tbb::parallel_for(size_t(0), size_t(img.width) * img.height, [&](size_t px) {
-            for (int c = 0; c < convert_channels; ++c) {
-                float x = img.img[px * img.channels + c] / 255.f;
-                x = srgb_to_linear(x);
-                img.img[px * img.channels + c] = glm::clamp(x * 255.f, 0.f, 255.f);
-            }
-        });
-    });
-
     for (auto &t : textures) {
         ospRelease(t);
     }
     textures.clear();
-    for (const auto &tex : scene.textures) {
+    for (const auto &tex : scene->textures) {
         const OSPDataType data_type = tex.channels == 3 ? OSP_VEC3UC : OSP_VEC4UC;
-        const int format = tex.channels == 3 ? OSP_TEXTURE_RGB8 : OSP_TEXTURE_RGBA8;
+        // sRGB textures are linearized by OSPRay when sampled
+        int format = tex.channels == 3 ? OSP_TEXTURE_RGB8 : OSP_TEXTURE_RGBA8;
+        if (tex.color_space == SRGB) {
+            format = tex.channels == 3 ? OSP_TEXTURE_SRGB : OSP_TEXTURE_SRGBA;
+        }
         const int filter = OSP_TEXTURE_FILTER_BILINEAR;
 
         OSPData tex_data =
@@ -118,7 +107,7 @@ void RenderOSPRay::set_scene(const Scene &in_scene)
         ospRelease(m);
     }
     materials.clear();
-    for (const auto &mat : scene.materials) {
+    for (const auto &mat : scene->materials) {
         OSPMaterial m = ospNewMaterial("pathtracer", "principled");
         const int tex_handle = *reinterpret_cast<const int *>(&mat.base_color.x);
         if (IS_TEXTURED_PARAM(tex_handle)) {
@@ -153,7 +142,7 @@ void RenderOSPRay::set_scene(const Scene &in_scene)
     }
 
     std::vector<std::vector<OSPGeometry>> meshes;
-    for (const auto &mesh : scene.meshes) {
+    for (const auto &mesh : scene->meshes) {
         std::vector<OSPGeometry> mesh_geometries;
         for (const auto &geom : mesh.geometries) {
             OSPData verts_data =
@@ -180,12 +169,12 @@ void RenderOSPRay::set_scene(const Scene &in_scene)
         ospRelease(i);
     }
     instances.clear();
-    for (const auto &inst : scene.instances) {
+    for (const auto &inst : scene->instances) {
         // Make models for each geometry in the instance's mesh to set the material
         std::vector<OSPGeometricModel> geom_models;
-        const auto &pm = scene.parameterized_meshes[inst.parameterized_mesh_id];
-        for (size_t i = 0; i < meshes[inst.parameterized_mesh_id].size(); ++i) {
-            OSPGeometricModel gm = ospNewGeometricModel(meshes[inst.parameterized_mesh_id][i]);
+        const auto &pm = scene->parameterized_meshes[inst.parameterized_mesh_id];
+        for (size_t i = 0; i < meshes[pm.mesh_id].size(); ++i) {
+            OSPGeometricModel gm = ospNewGeometricModel(meshes[pm.mesh_id][i]);
             ospSetParam(gm, "material", OSP_UINT, &pm.material_ids[i]);
             ospCommit(gm);
             geom_models.push_back(gm);
@@ -222,7 +211,7 @@ void RenderOSPRay::set_scene(const Scene &in_scene)
         ospRelease(l);
     }
     lights.clear();
-    for (const auto &light : scene.lights) {
+    for (const auto &light : scene->lights) {
         OSPLight l = ospNewLight("quad");
 
         const glm::vec3 color = glm::normalize(glm::vec3(light.emission));
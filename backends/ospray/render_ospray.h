@@ -10,7 +10,8 @@ struct RenderOSPRay : RenderBackend {
     OSPFrameBuffer fb;
     OSPWorld world;
 
-    Scene scene;
+    // The textures and geometry are shared with OSPRay, so we keep the scene alive
+    std::shared_ptr<const Scene> scene;
     std::vector<OSPTexture> textures;
     std::vector<OSPMaterial> materials;
     std::vector<OSPInstance> instances;
@@ -22,6 +23,7 @@ struct RenderOSPRay : RenderBackend {
     std::string name() override;
     void initialize(const int fb_width, const int fb_height) override;
     void set_scene(const Scene &scene) override;
+    void set_scene(std::shared_ptr<const Scene> scene) override;
     RenderStats render(const glm::vec3 &pos,
                        const glm::vec3 &dir,
                        const glm::vec3 &up,
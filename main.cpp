@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <iostream>
 #include <memory>
 #include <numeric>
@@ -14,6 +15,7 @@
 #include "util/display/display.h"
 #include "util/display/gldisplay.h"
 #include "util/display/imgui_impl_sdl.h"
+#include "util/display/nulldisplay.h"
 #include "util/render_plugin.h"
 
 const std::string USAGE =
@@ -30,11 +32,52 @@ const std::string USAGE =
     "\t-img <x> <y>           Specify the window dimensions. Defaults to 1280x720\n"
     "\t-mat-mode <MODE>       Specify the material mode, default (the default) or "
     "white_diffuse\n"
+    "\t-benchmark-frames <n>  Render n frames, save the image and report the average\n"
+    "\t                       render time then exit\n"
+    "\t-headless              Run without a window or display, rendering offscreen\n"
+    "\t                       at the -img size. Requires -benchmark-frames\n"
+    "\t-no-scene-cache        Don't load or write the <scene>.crtcache scene cache\n"
+    "\t-frame-budget-ms <ms>  Pick the samples per pixel each frame to render it in\n"
+    "\t                       about ms milliseconds, if the backend supports it\n"
+    "Embree Options:\n"
+    "\t-bvh-quality <QUALITY> Set the BVH build quality, low, medium (the default) or\n"
+    "\t                       high. High quality uses spatial splits\n"
+    "\t-bvh-compact           Build compact BVHs which use less memory\n"
+    "\t-bvh-progressive       Start rendering on a low quality BVH while the BVH at the\n"
+    "\t                       set quality is built in the background\n"
+    "\t-tile-size <n>         Render in n x n pixel tiles. By default the tile size is\n"
+    "\t                       picked based on the image size and number of threads\n"
+    "\t-wavefront             Render with the wavefront path tracing kernel\n"
+    "\t-sort-hits             Sort hits by material before shading them in the\n"
+    "\t                       wavefront kernel\n"
+    "\t-path-regeneration     Render with the path regeneration kernel, which starts a\n"
+    "\t                       new path on each SIMD lane as soon as its path ends\n"
+    "\t-tasking <SCHEDULER>   Set the scheduler the tiles are rendered on, tbb (the\n"
+    "\t                       default), openmp (if built with OpenMP) or pool\n"
+    "\t-tasking-benchmark     Report each scheduler's overhead and the average tail\n"
+    "\t                       latency of the render loop\n"
+    "\t-threads <n>           Render and build BVHs on n threads\n"
+    "\t-affinity              Pin Embree's and the render threads to CPUs, spread\n"
+    "\t                       across the NUMA nodes\n"
+    "\t-numa-replicate        Copy the materials, lights and textures into each NUMA\n"
+    "\t                       node's memory and render a band of the image per node\n"
+    "\t-adaptive-threshold <t> Stop sampling pixels once their relative error is below\n"
+    "\t                       t (e.g. 0.01), and give their samples to noisier pixels\n"
+    "\t-interactive-scale <s> Render at s times the resolution while the camera is\n"
+    "\t                       moving (default 0.5), 1 renders at full resolution\n"
+    "\t-interactive-depth <n> Limit paths to n bounces while the camera is moving\n"
+    "\t                       (default 2)\n"
+    "\t-denoise <MODE>        Denoise with Open Image Denoise (if built with it) using\n"
+    "\t                       albedo and normal AOVs, every frame (every) or only the\n"
+    "\t                       frames which are saved (final)\n"
+    "\t-reproject             Reproject the accumulated samples into the new view when\n"
+    "\t                       the camera moves instead of restarting the accumulation\n"
     "\n";
 
 int win_width = 1280;
 int win_height = 720;
 
+// Note: window is null when running headless
 void run_app(const std::vector<std::string> &args,
              SDL_Window *window,
              Display *display,
@@ -57,6 +100,26 @@ int main(int argc, const char **argv)
         return 1;
     }
 
+    bool headless = false;
+    for (size_t i = 2; i < args.size(); ++i) {
+        if (args[i] == "-img") {
+            win_width = std::stoi(args[++i]);
+            win_height = std::stoi(args[++i]);
+        } else if (args[i] == "-headless") {
+            headless = true;
+        }
+    }
+
+    // When running headless we skip all the SDL, ImGui and window/GL context setup
+    // so that CPU backends can run on nodes without an X server or GPU
+    if (headless) {
+        std::unique_ptr<RenderPlugin> render_plugin =
+            std::make_unique<RenderPlugin>("crt_" + args[1]);
+        NullDisplay display;
+        run_app(args, nullptr, &display, render_plugin.get());
+        return 0;
+    }
+
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
         std::cerr << "Failed to init SDL: " << SDL_GetError() << "\n";
         return -1;
@@ -64,13 +127,6 @@ int main(int argc, const char **argv)
 
     std::unique_ptr<RenderPlugin> render_plugin =
         std::make_unique<RenderPlugin>("crt_" + args[1]);
-    for (size_t i = 2; i < args.size(); ++i) {
-        if (args[i] == "-img") {
-            win_width = std::stoi(args[++i]);
-            win_height = std::stoi(args[++i]);
-            continue;
-        }
-    }
 
     const uint32_t window_flags = render_plugin->get_window_flags() | SDL_WINDOW_RESIZABLE;
     if (window_flags & SDL_WINDOW_OPENGL) {
@@ -115,7 +171,7 @@ void run_app(const std::vector<std::string> &args,
              Display *display,
              RenderPlugin *render_plugin)
 {
-    ImGuiIO &io = ImGui::GetIO();
+    const bool headless = window == nullptr;
 
     std::string scene_file;
     bool got_camera_args = false;
@@ -124,10 +180,15 @@ void run_app(const std::vector<std::string> &args,
     glm::vec3 up(0, 1, 0);
     float fov_y = 65.f;
     uint32_t samples_per_pixel = 1;
+    float frame_budget_ms = 0.f;
     size_t camera_id = 0;
     size_t benchmark_frames = 0;
     std::string validation_img_prefix;
     MaterialMode material_mode = MaterialMode::DEFAULT;
+    bool use_scene_cache = true;
+
+    // The renderer is made before parsing the arguments so it can parse its own options
+    std::unique_ptr<RenderBackend> renderer = render_plugin->make_renderer(display);
     for (size_t i = 1; i < args.size(); ++i) {
         if (args[i] == "-eye") {
             eye.x = std::stof(args[++i]);
@@ -155,20 +216,26 @@ void run_app(const std::vector<std::string> &args,
             validation_img_prefix = args[++i];
         } else if (args[i] == "-img") {
             i += 2;
+        } else if (args[i] == "-headless") {
+            continue;
         } else if (args[i] == "-mat-mode") {
             if (args[++i] == "white_diffuse") {
                 material_mode = MaterialMode::WHITE_DIFFUSE;
             }
         } else if (args[i] == "-benchmark-frames") {
             benchmark_frames = std::stoi(args[++i]);
+        } else if (args[i] == "-no-scene-cache") {
+            use_scene_cache = false;
+        } else if (args[i] == "-frame-budget-ms") {
+            frame_budget_ms = std::stof(args[++i]);
+        } else if (renderer && renderer->parse_arg(args, i)) {
+            continue;
         } else if (args[i][0] != '-') {
             scene_file = args[i];
             canonicalize_path(scene_file);
         }
     }
 
-    std::unique_ptr<RenderBackend> renderer = render_plugin->make_renderer(display);
-
     if (!renderer) {
         std::cout << "Error: No renderer backend or invalid backend name specified\n" << USAGE;
         std::exit(1);
@@ -177,40 +244,74 @@ void run_app(const std::vector<std::string> &args,
         std::cout << "Error: No model file specified\n" << USAGE;
         std::exit(1);
     }
+    if (headless && benchmark_frames == 0) {
+        std::cout << "Error: -headless requires -benchmark-frames to be set\n" << USAGE;
+        std::exit(1);
+    }
+    renderer->frame_budget_ms = frame_budget_ms;
 
     display->resize(win_width, win_height);
     renderer->initialize(win_width, win_height);
 
     std::string scene_info;
     {
-        Scene scene(scene_file, material_mode);
-        scene.samples_per_pixel = samples_per_pixel;
+        using namespace std::chrono;
+        const auto load_start = steady_clock::now();
+        // Pass the scene to the renderer while it's loading, so that the renderer can
+        // start setting up the geometry while the textures are decoded and the scene
+        // cache is written
+        renderer->begin_scene();
+        auto scene = std::make_shared<Scene>(
+            scene_file, material_mode, use_scene_cache, renderer.get());
+        scene->samples_per_pixel = samples_per_pixel;
+        const float load_time =
+            duration_cast<duration<float, std::milli>>(steady_clock::now() - load_start)
+                .count();
 
         std::stringstream ss;
         ss << "Scene '" << scene_file << "':\n"
-           << "# Unique Triangles: " << pretty_print_count(scene.unique_tris()) << "\n"
-           << "# Total Triangles: " << pretty_print_count(scene.total_tris()) << "\n"
-           << "# Geometries: " << scene.num_geometries() << "\n"
-           << "# Meshes: " << scene.meshes.size() << "\n"
-           << "# Parameterized Meshes: " << scene.parameterized_meshes.size() << "\n"
-           << "# Instances: " << scene.instances.size() << "\n"
-           << "# Materials: " << scene.materials.size() << "\n"
-           << "# Textures: " << scene.textures.size() << "\n"
-           << "# Lights: " << scene.lights.size() << "\n"
-           << "# Cameras: " << scene.cameras.size() << "\n"
-           << "# Samples per Pixel: " << scene.samples_per_pixel;
+           << "# Unique Triangles: " << pretty_print_count(scene->unique_tris()) << "\n"
+           << "# Total Triangles: " << pretty_print_count(scene->total_tris()) << "\n"
+           << "# Geometries: " << scene->num_geometries() << "\n"
+           << "# Meshes: " << scene->meshes.size() << "\n"
+           << "# Parameterized Meshes: " << scene->parameterized_meshes.size() << "\n"
+           << "# Instances: " << scene->num_instances() << "\n"
+           << "# Instance Groups: " << scene->instance_groups.size() << "\n"
+           << "# Instancing Levels: " << scene->instance_levels() << "\n"
+           << "# Materials: " << scene->materials.size() << "\n"
+           << "# Textures: " << scene->textures.size() << "\n"
+           << "# Lights: " << scene->lights.size() << "\n"
+           << "# Cameras: " << scene->cameras.size() << "\n"
+           << "# Samples per Pixel: " << scene->samples_per_pixel << "\n"
+           << "Load Time: " << load_time << "ms";
 
         scene_info = ss.str();
         std::cout << scene_info << "\n";
 
-        renderer->set_scene(scene);
+        if (scene->instance_levels() > renderer->max_instance_levels()) {
+            std::cout << "Flattening scene to single level instancing for "
+                      << renderer->name() << "\n";
+            scene->flatten_instances();
+        }
 
-        if (!got_camera_args && !scene.cameras.empty()) {
-            eye = scene.cameras[camera_id].position;
-            center = scene.cameras[camera_id].center;
-            up = scene.cameras[camera_id].up;
-            fov_y = scene.cameras[camera_id].fov_y;
+        if (!got_camera_args && !scene->cameras.empty()) {
+            eye = scene->cameras[camera_id].position;
+            center = scene->cameras[camera_id].center;
+            up = scene->cameras[camera_id].up;
+            fov_y = scene->cameras[camera_id].fov_y;
         }
+
+        // Finish setting up the scene in the renderer, which can keep it instead of
+        // copying it
+        const auto setup_start = steady_clock::now();
+        renderer->end_scene(std::move(scene));
+        const float setup_time =
+            duration_cast<duration<float, std::milli>>(steady_clock::now() - setup_start)
+                .count();
+
+        ss << "\nScene Setup Time: " << setup_time << "ms";
+        scene_info = ss.str();
+        std::cout << "Scene Setup Time: " << setup_time << "ms\n";
     }
 
     ArcballCamera camera(eye, center, up);
@@ -230,7 +331,8 @@ void run_app(const std::vector<std::string> &args,
     bool save_image = false;
     while (!done) {
         SDL_Event event;
-        while (SDL_PollEvent(&event)) {
+        while (!headless && SDL_PollEvent(&event)) {
+            ImGuiIO &io = ImGui::GetIO();
             ImGui_ImplSDL2_ProcessEvent(&event);
             if (event.type == SDL_QUIT) {
                 done = true;
@@ -341,9 +443,17 @@ void run_app(const std::vector<std::string> &args,
                 std::cout << "Rays per-second " << rays_per_second / frame_id << " Ray/s ("
                           << rays_per_sec << "Ray/s)\n";
             }
+            if (stats.samples_per_pixel > 0) {
+                std::cout << "Effective samples per-pixel: " << stats.samples_per_pixel
+                          << "\n";
+            }
             done = true;
         }
 
+        if (headless) {
+            continue;
+        }
+
         display->new_frame();
 
         ImGui_ImplSDL2_NewFrame(window);
@@ -358,6 +468,16 @@ void run_app(const std::vector<std::string> &args,
             const std::string rays_per_sec = pretty_print_count(rays_per_second / frame_id);
             ImGui::Text("Rays per-second: %sRay/s", rays_per_sec.c_str());
         }
+        if (stats.samples_per_pixel > 0) {
+            ImGui::Text("Effective samples per-pixel: %.1f", stats.samples_per_pixel);
+        }
+        if (stats.interactive_quality) {
+            ImGui::Text("Render Quality: interactive (%.0f%% resolution, max depth %u)",
+                        stats.render_scale * 100.f,
+                        stats.max_path_depth);
+        } else {
+            ImGui::Text("Render Quality: full");
+        }
 
         ImGui::Text("Total Application Time: %.3f ms/frame (%.1f FPS)",
                     1000.0f / ImGui::GetIO().Framerate,
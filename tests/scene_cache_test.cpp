@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "scene.h"
+#include "scene_cache.h"
+#include "stb_image_write.h"
+
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+namespace {
+
+int failures = 0;
+
+void check(const bool cond, const std::string &msg)
+{
+    if (!cond) {
+        std::cout << "FAILED: " << msg << "\n";
+        ++failures;
+    }
+}
+
+void write_file(const std::string &file, const std::string &content)
+{
+    std::ofstream fout(file.c_str(), std::ios::binary | std::ios::trunc);
+    fout << content;
+}
+
+// Set the file's modification time explicitly, as rewriting a file right after the cache
+// was written isn't guaranteed to change it
+void set_mtime(const std::string &file, const time_t mtime)
+{
+    struct utimbuf times;
+    times.actime = mtime;
+    times.modtime = mtime;
+    utime(file.c_str(), &times);
+}
+
+template <typename T>
+bool buffers_equal(const T *a, const size_t a_size, const T *b, const size_t b_size)
+{
+    return a_size == b_size && (a_size == 0 || std::memcmp(a, b, a_size * sizeof(T)) == 0);
+}
+
+template <typename T>
+bool buffers_equal(const GeometryBuffer<T> &a, const GeometryBuffer<T> &b)
+{
+    return buffers_equal(a.data(), a.size(), b.data(), b.size());
+}
+
+bool has_dependency(const Scene &scene, const std::string &file)
+{
+    return std::find(scene.dependencies.begin(), scene.dependencies.end(), file) !=
+           scene.dependencies.end();
+}
+
+// Check that the scene loaded from the cache has the same content as the parsed scene
+void check_scene_equal(const Scene &parsed, const Scene &cached)
+{
+    check(cached.meshes.size() == parsed.meshes.size(), "the mesh count matches");
+    for (size_t i = 0; i < std::min(parsed.meshes.size(), cached.meshes.size()); ++i) {
+        const auto &a = parsed.meshes[i].geometries;
+        const auto &b = cached.meshes[i].geometries;
+        check(a.size() == b.size(), "the geometry count matches");
+        for (size_t j = 0; j < std::min(a.size(), b.size()); ++j) {
+            check(buffers_equal(a[j].vertices, b[j].vertices), "the vertices match");
+            check(buffers_equal(a[j].normals, b[j].normals), "the normals match");
+            check(buffers_equal(a[j].uvs, b[j].uvs), "the uvs match");
+            check(buffers_equal(a[j].indices, b[j].indices), "the indices match");
+        }
+    }
+
+    check(cached.parameterized_meshes.size() == parsed.parameterized_meshes.size(),
+          "the parameterized mesh count matches");
+    for (size_t i = 0;
+         i < std::min(parsed.parameterized_meshes.size(), cached.parameterized_meshes.size());
+         ++i) {
+        const auto &a = parsed.parameterized_meshes[i];
+        const auto &b = cached.parameterized_meshes[i];
+        check(a.mesh_id == b.mesh_id && a.material_ids == b.material_ids,
+              "the parameterized meshes match");
+    }
+
+    check(cached.instances.size() == parsed.instances.size(), "the instance count matches");
+    for (size_t i = 0; i < std::min(parsed.instances.size(), cached.instances.size()); ++i) {
+        const auto &a = parsed.instances[i];
+        const auto &b = cached.instances[i];
+        check(a.transform == b.transform && a.parameterized_mesh_id == b.parameterized_mesh_id,
+              "the instances match");
+    }
+
+    check(buffers_equal(parsed.materials.data(),
+                        parsed.materials.size(),
+                        cached.materials.data(),
+                        cached.materials.size()),
+          "the materials match");
+
+    check(cached.textures.size() == parsed.textures.size(), "the texture count matches");
+    for (size_t i = 0; i < std::min(parsed.textures.size(), cached.textures.size()); ++i) {
+        const Image &a = parsed.textures[i];
+        const Image &b = cached.textures[i];
+        check(a.name == b.name && a.width == b.width && a.height == b.height &&
+                  a.channels == b.channels && a.color_space == b.color_space,
+              "the texture parameters match");
+        check(buffers_equal(a.img, b.img), "the texture data matches");
+        check(b.img.is_reference(), "the cached texture data references the cache");
+    }
+}
+
+}
+
+/* Check that the scene loaded from the scene cache matches the parsed scene, that the
+ * cache is invalidated when a file referenced by the scene changes, and not when a file
+ * is only touched. Takes the directory to write the test scene to
+ */
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        std::cout << "Usage: " << argv[0] << " <output dir>\n";
+        return 1;
+    }
+    const std::string dir = argv[1];
+    const std::string obj_file = dir + "/scene_cache_test.obj";
+    const std::string mtl_file = dir + "/scene_cache_test.mtl";
+    const std::string tex_file = dir + "/scene_cache_test.png";
+    std::remove(scene_cache_file(obj_file).c_str());
+
+    // Two groups, one with a red material and one with a textured material
+    const std::string obj =
+        "mtllib scene_cache_test.mtl\n"
+        "v 0 0 0\nv 1 0 0\nv 0 1 0\nv 1 1 0\n"
+        "vn 0 0 1\n"
+        "vt 0 0\nvt 1 0\nvt 0 1\nvt 1 1\n"
+        "g red\n"
+        "usemtl red\n"
+        "f 1/1/1 2/2/1 3/3/1\n"
+        "g textured\n"
+        "usemtl textured\n"
+        "f 2/2/1 4/4/1 3/3/1\n";
+    write_file(obj_file, obj);
+    write_file(mtl_file,
+               "newmtl red\nKd 1 0 0\n"
+               "newmtl textured\nKd 1 1 1\nmap_Kd scene_cache_test.png\n");
+    const uint8_t texels[] = {255, 0,   0,   255, 0,   255, 0,   255,
+                              0,   0,   255, 255, 255, 255, 255, 255};
+    stbi_write_png(tex_file.c_str(), 2, 2, 4, texels, 2 * 4);
+
+    const Scene parsed(obj_file, MaterialMode::DEFAULT, false);
+    check(parsed.dependencies.size() == 2 && has_dependency(parsed, mtl_file) &&
+              has_dependency(parsed, tex_file),
+          "the MTL file and texture are recorded as dependencies");
+    check(!parsed.parameterized_meshes.empty() &&
+              !parsed.parameterized_meshes[0].material_ids.empty() &&
+              parsed.materials[parsed.parameterized_meshes[0].material_ids[0]].base_color ==
+                  glm::vec3(1.f, 0.f, 0.f),
+          "the first group's material has Kd = (1, 0, 0)");
+
+    // Loading the scene writes the cache
+    { Scene scene(obj_file, MaterialMode::DEFAULT, true); }
+    {
+        Scene scene;
+        check(load_scene_cache(obj_file, scene), "the cache is valid after writing it");
+        check(scene.dependencies.size() == 2 && has_dependency(scene, mtl_file) &&
+                  has_dependency(scene, tex_file),
+              "the dependencies are restored from the cache");
+        check_scene_equal(parsed, scene);
+    }
+
+    // Touching the scene file only changes its modification time, so its contents are
+    // hashed to check it's unchanged
+    const time_t touched_mtime = std::time(nullptr) + 3600;
+    set_mtime(obj_file, touched_mtime);
+    {
+        Scene scene;
+        check(load_scene_cache(obj_file, scene),
+              "the cache is valid after touching the scene file");
+    }
+    /* The touched file's modification time is stored in the cache when it's loaded, so
+     * it isn't hashed again while its modification time matches. Changing the file's
+     * contents without changing its size or modification time isn't detected, which shows
+     * the stored modification time was updated
+     */
+    std::string changed_obj = obj;
+    changed_obj.replace(changed_obj.find("v 1 1 0"), 7, "v 1 1 1");
+    write_file(obj_file, changed_obj);
+    set_mtime(obj_file, touched_mtime);
+    {
+        Scene scene;
+        check(load_scene_cache(obj_file, scene),
+              "the touched file's modification time was stored in the cache");
+    }
+
+    // Changing the MTL file must invalidate the cache
+    write_file(mtl_file, "newmtl red\nKd 0.5 0.5 0\n");
+    set_mtime(mtl_file, touched_mtime + 1);
+    {
+        Scene scene;
+        check(!load_scene_cache(obj_file, scene),
+              "the cache is invalid after changing the MTL file");
+    }
+
+    std::remove(scene_cache_file(obj_file).c_str());
+    std::remove(obj_file.c_str());
+    std::remove(mtl_file.c_str());
+    std::remove(tex_file.c_str());
+
+    if (failures != 0) {
+        std::cout << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "All checks passed\n";
+    return 0;
+}
@@ -0,0 +1,40 @@
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "util.h"
+
+namespace {
+
+int failures = 0;
+
+void check_hash(const std::string &input, const uint64_t seed, const uint64_t expected)
+{
+    const uint64_t hash = xxhash64(input.data(), input.size(), seed);
+    if (hash != expected) {
+        std::cout << "FAILED: xxhash64 of \"" << input << "\" with seed " << seed << " is "
+                  << std::hex << hash << ", expected " << expected << std::dec << "\n";
+        ++failures;
+    }
+}
+
+}
+
+// Check xxhash64 against the hashes computed by the reference XXH64 implementation
+int main()
+{
+    check_hash("", 0, 0xef46db3751d8e999ULL);
+    check_hash("", 1, 0xd5afba1336a3be4bULL);
+    check_hash("abc", 0, 0x44bc2cf5ad770999ULL);
+    // Inputs over 32 bytes are hashed in 32 byte stripes
+    check_hash("Nobody inspects the spammish repetition", 0, 0xfbcea83c8a378bf1ULL);
+    const std::string long_input = "The quick brown fox jumps over the lazy dog, twice over.";
+    check_hash(long_input, 0, 0xfb9f56ced8ad4fc4ULL);
+    check_hash(long_input, 0x9e3779b97f4a7c15ULL, 0x640f68bd90ba54afULL);
+
+    if (failures != 0) {
+        std::cout << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "All checks passed\n";
+    return 0;
+}
@@ -0,0 +1,17 @@
+#include "nulldisplay.h"
+
+std::string NullDisplay::gpu_brand()
+{
+    return "None";
+}
+
+std::string NullDisplay::name()
+{
+    return "Headless";
+}
+
+void NullDisplay::resize(const int, const int) {}
+
+void NullDisplay::new_frame() {}
+
+void NullDisplay::display(RenderBackend *) {}
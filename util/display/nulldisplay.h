@@ -0,0 +1,18 @@
+#pragma once
+
+#include "display.h"
+
+/* A display which doesn't present anything, used when running headless. The
+ * renderer's output is only available through RenderBackend::img
+ */
+struct NullDisplay : Display {
+    std::string gpu_brand() override;
+
+    std::string name() override;
+
+    void resize(const int fb_width, const int fb_height) override;
+
+    void new_frame() override;
+
+    void display(RenderBackend *renderer) override;
+};
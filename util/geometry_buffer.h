@@ -0,0 +1,223 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+/* A buffer of geometry or texture data that either owns its data, or references memory
+ * owned by something else (e.g., a memory mapped scene cache) which it keeps alive through
+ * a shared_ptr. Copies of a buffer share the underlying data, and a buffer makes its own
+ * copy of the data before it is modified if the data is shared or not owned by it.
+ *
+ * The buffer also tracks how many elements of readable memory follow the data, so that
+ * it can be passed to APIs which read past the end of the buffer (e.g., Embree reads the
+ * last vertex as 16 bytes) without making a padded copy of the data.
+ */
+template <typename T>
+class GeometryBuffer {
+    std::shared_ptr<std::vector<T>> storage;
+
+    // The owner of the referenced memory, if the buffer doesn't own its data
+    std::shared_ptr<const void> owner;
+    const T *ref_data = nullptr;
+    size_t ref_size = 0;
+
+    // The number of readable elements following the data. For owned data these are
+    // stored at the end of the storage
+    size_t padding_count = 0;
+
+    // Get the owned storage for the buffer, copying the data if it's shared or referenced
+    std::vector<T> &mutable_storage();
+
+public:
+    using value_type = T;
+    using const_iterator = const T *;
+
+    GeometryBuffer() = default;
+
+    GeometryBuffer(std::vector<T> data);
+
+    template <typename It>
+    GeometryBuffer(It begin, It end);
+
+    /* Reference count elements of existing memory, which is kept alive by owner. padding
+     * is the number of elements of memory after the data which are also safe to read
+     */
+    GeometryBuffer(const T *data,
+                   size_t count,
+                   std::shared_ptr<const void> owner,
+                   size_t padding = 0);
+
+    const T *data() const;
+
+    // Get writable access to the data, copying it first if it's shared or referenced
+    T *mutable_data();
+
+    size_t size() const;
+
+    bool empty() const;
+
+    // True if the buffer references memory it doesn't own
+    bool is_reference() const;
+
+    // The number of readable elements following the end of the data
+    size_t padding() const;
+
+    // Make sure at least n readable elements follow the end of the data, copying the
+    // data if it's shared or referenced and not already padded enough
+    void pad(const size_t n);
+
+    const T *begin() const;
+
+    const T *end() const;
+
+    const T &operator[](const size_t i) const;
+
+    void reserve(const size_t n);
+
+    void push_back(const T &t);
+
+    template <typename... Args>
+    void emplace_back(Args &&... args);
+};
+
+template <typename T>
+GeometryBuffer<T>::GeometryBuffer(std::vector<T> data)
+    : storage(std::make_shared<std::vector<T>>(std::move(data)))
+{
+}
+
+template <typename T>
+template <typename It>
+GeometryBuffer<T>::GeometryBuffer(It begin, It end)
+    : storage(std::make_shared<std::vector<T>>(begin, end))
+{
+}
+
+template <typename T>
+GeometryBuffer<T>::GeometryBuffer(const T *data,
+                                  size_t count,
+                                  std::shared_ptr<const void> owner,
+                                  size_t padding)
+    : owner(owner), ref_data(data), ref_size(count), padding_count(padding)
+{
+}
+
+template <typename T>
+std::vector<T> &GeometryBuffer<T>::mutable_storage()
+{
+    if (owner) {
+        storage = std::make_shared<std::vector<T>>(ref_data, ref_data + ref_size);
+        owner = nullptr;
+        ref_data = nullptr;
+        ref_size = 0;
+    } else if (!storage) {
+        storage = std::make_shared<std::vector<T>>();
+    } else if (storage.use_count() > 1) {
+        storage = std::make_shared<std::vector<T>>(storage->begin(),
+                                                   storage->end() - padding_count);
+    } else {
+        storage->resize(storage->size() - padding_count);
+    }
+    padding_count = 0;
+    return *storage;
+}
+
+template <typename T>
+const T *GeometryBuffer<T>::data() const
+{
+    if (owner) {
+        return ref_data;
+    }
+    return storage ? storage->data() : nullptr;
+}
+
+template <typename T>
+T *GeometryBuffer<T>::mutable_data()
+{
+    return mutable_storage().data();
+}
+
+template <typename T>
+size_t GeometryBuffer<T>::size() const
+{
+    if (owner) {
+        return ref_size;
+    }
+    return storage ? storage->size() - padding_count : 0;
+}
+
+template <typename T>
+bool GeometryBuffer<T>::empty() const
+{
+    return size() == 0;
+}
+
+template <typename T>
+bool GeometryBuffer<T>::is_reference() const
+{
+    return owner != nullptr;
+}
+
+template <typename T>
+size_t GeometryBuffer<T>::padding() const
+{
+    return padding_count;
+}
+
+template <typename T>
+void GeometryBuffer<T>::pad(const size_t n)
+{
+    if (padding_count >= n) {
+        return;
+    }
+    const size_t count = size();
+    if (owner || !storage || storage.use_count() > 1) {
+        auto padded = std::make_shared<std::vector<T>>();
+        padded->reserve(count + n);
+        padded->insert(padded->end(), begin(), end());
+        storage = padded;
+        owner = nullptr;
+        ref_data = nullptr;
+        ref_size = 0;
+    }
+    storage->resize(count + n, T());
+    padding_count = n;
+}
+
+template <typename T>
+const T *GeometryBuffer<T>::begin() const
+{
+    return data();
+}
+
+template <typename T>
+const T *GeometryBuffer<T>::end() const
+{
+    return data() + size();
+}
+
+template <typename T>
+const T &GeometryBuffer<T>::operator[](const size_t i) const
+{
+    return data()[i];
+}
+
+template <typename T>
+void GeometryBuffer<T>::reserve(const size_t n)
+{
+    mutable_storage().reserve(n);
+}
+
+template <typename T>
+void GeometryBuffer<T>::push_back(const T &t)
+{
+    mutable_storage().push_back(t);
+}
+
+template <typename T>
+template <typename... Args>
+void GeometryBuffer<T>::emplace_back(Args &&... args)
+{
+    mutable_storage().emplace_back(std::forward<Args>(args)...);
+}
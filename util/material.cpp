@@ -1,19 +1,12 @@
 #include "material.h"
+#include <algorithm>
 #include <stdexcept>
 #include "stb_image.h"
 
 Image::Image(const std::string &file, const std::string &name, ColorSpace color_space)
     : name(name), color_space(color_space)
 {
-    stbi_set_flip_vertically_on_load(1);
-    uint8_t *data = stbi_load(file.c_str(), &width, &height, &channels, 4);
-    channels = 4;
-    if (!data) {
-        throw std::runtime_error("Failed to load " + file);
-    }
-    img = std::vector<uint8_t>(data, data + width * height * channels);
-    stbi_image_free(data);
-    stbi_set_flip_vertically_on_load(0);
+    decode(file, true);
 }
 
 Image::Image(const uint8_t *buf,
@@ -31,3 +24,42 @@ Image::Image(const uint8_t *buf,
 {
 }
 
+void Image::decode(const uint8_t *encoded, size_t encoded_size, bool flip_vertically)
+{
+    uint8_t *data =
+        stbi_load_from_memory(encoded, encoded_size, &width, &height, &channels, 4);
+    channels = 4;
+    if (!data) {
+        throw std::runtime_error("Failed to decode " + name);
+    }
+    img = std::vector<uint8_t>(data, data + width * height * channels);
+    stbi_image_free(data);
+    if (flip_vertically) {
+        this->flip_vertically();
+    }
+}
+
+void Image::decode(const std::string &file, bool flip_vertically)
+{
+    uint8_t *data = stbi_load(file.c_str(), &width, &height, &channels, 4);
+    channels = 4;
+    if (!data) {
+        throw std::runtime_error("Failed to load " + file);
+    }
+    img = std::vector<uint8_t>(data, data + width * height * channels);
+    stbi_image_free(data);
+    if (flip_vertically) {
+        this->flip_vertically();
+    }
+}
+
+void Image::flip_vertically()
+{
+    const size_t row_size = size_t(width) * channels;
+    uint8_t *texels = img.mutable_data();
+    for (int y = 0; y < height / 2; ++y) {
+        std::swap_ranges(texels + y * row_size,
+                         texels + (y + 1) * row_size,
+                         texels + (height - 1 - y) * row_size);
+    }
+}
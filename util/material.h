@@ -3,6 +3,7 @@
 #include <memory>
 #include <string>
 #include <vector>
+#include "geometry_buffer.h"
 #include "texture_channel_mask.h"
 #include <glm/glm.hpp>
 
@@ -13,9 +14,12 @@ struct Image {
     int width = -1;
     int height = -1;
     int channels = -1;
-    std::vector<uint8_t> img;
+    // The texels, which may reference a mapped scene cache instead of being owned by the
+    // image, see GeometryBuffer
+    GeometryBuffer<uint8_t> img;
     ColorSpace color_space = LINEAR;
 
+    // Load an image file, the image is flipped vertically
     Image(const std::string &file, const std::string &name, ColorSpace color_space = LINEAR);
     Image(const uint8_t *buf,
           int width,
@@ -24,6 +28,18 @@ struct Image {
           const std::string &name,
           ColorSpace color_space = LINEAR);
     Image() = default;
+
+    // Decode an encoded image (PNG, JPG, etc.) from memory into a 4 channel image
+    void decode(const uint8_t *encoded, size_t encoded_size, bool flip_vertically);
+
+    // Load an image file into a 4 channel image
+    void decode(const std::string &file, bool flip_vertically);
+
+    /* Flip the image vertically. Images are flipped after decoding instead of using
+     * stb_image's global flip on load setting so that images can be decoded on
+     * multiple threads
+     */
+    void flip_vertically();
 };
 
 struct DisneyMaterial {
@@ -26,3 +26,8 @@ Instance::Instance(const glm::mat4 &transform, size_t parameterized_mesh_id)
     : transform(transform), parameterized_mesh_id(parameterized_mesh_id)
 {
 }
+
+GroupInstance::GroupInstance(const glm::mat4 &transform, size_t group_id)
+    : transform(transform), group_id(group_id)
+{
+}
@@ -1,12 +1,13 @@
 #pragma once
 
 #include <vector>
+#include "geometry_buffer.h"
 #include <glm/glm.hpp>
 
 struct Geometry {
-    std::vector<glm::vec3> vertices, normals;
-    std::vector<glm::vec2> uvs;
-    std::vector<glm::uvec3> indices;
+    GeometryBuffer<glm::vec3> vertices, normals;
+    GeometryBuffer<glm::vec2> uvs;
+    GeometryBuffer<glm::uvec3> indices;
 
     size_t num_tris() const;
 };
@@ -45,3 +46,26 @@ struct Instance {
 
     Instance() = default;
 };
+
+/* A group instance places an instance group at some location in the scene, or within
+ * another instance group
+ */
+struct GroupInstance {
+    glm::mat4 transform;
+    size_t group_id;
+
+    GroupInstance(const glm::mat4 &transform, size_t group_id);
+
+    GroupInstance() = default;
+};
+
+/* An instance group is a set of instances and instances of other groups which is placed
+ * in the scene as a unit by group instances, for multi-level instancing (e.g., a forest
+ * made of trees made of branches). The transforms of the instances in the group are
+ * relative to the group. Groups can be instanced by multiple groups but must not
+ * instance themselves, directly or indirectly.
+ */
+struct InstanceGroup {
+    std::vector<Instance> instances;
+    std::vector<GroupInstance> group_instances;
+};
@@ -0,0 +1,649 @@
+#include "obj_parser.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include "file_mapping.h"
+#include "parallel_for.h"
+#include "phmap.h"
+#include "phmap_utils.h"
+#include <glm/glm.hpp>
+
+namespace {
+
+enum class ObjLine { VERTEX, NORMAL, TEXCOORD, FACE, GROUP, OBJECT, USEMTL, MTLLIB, OTHER };
+
+struct UVec3Hash {
+    size_t operator()(const glm::uvec3 &v) const
+    {
+        return phmap::HashState().combine(0, v.x, v.y, v.z);
+    }
+};
+
+/* A run of faces within a chunk of the file. A new run is started each time a g, o or
+ * usemtl statement is encountered, runs started by g or o begin a new shape.
+ */
+struct ObjRun {
+    bool new_shape = false;
+    std::string name;
+
+    // If set, the run starts with a usemtl statement changing the active material,
+    // otherwise the material active at the end of the previous run is used
+    bool set_material = false;
+    std::string material;
+
+    // The triangulated faces, stored as (position, normal, uv) index triples per-vertex
+    std::vector<glm::uvec3> verts;
+};
+
+/* The shapes' vertices are deduplicated in chunks of up to DEDUP_CHUNK_VERTS face
+ * vertices in parallel, so large shapes are split over multiple threads. The unique
+ * vertices of shapes with multiple chunks are merged in DEDUP_SHARDS shards by hash
+ */
+const size_t DEDUP_CHUNK_VERTS = 3 * 128 * 1024;
+const size_t DEDUP_SHARD_BITS = 6;
+const size_t DEDUP_SHARDS = size_t(1) << DEDUP_SHARD_BITS;
+
+// A range of a run's face vertices
+struct RunSlice {
+    const ObjRun *run = nullptr;
+    size_t begin = 0;
+    size_t end = 0;
+};
+
+/* A chunk of a shape's face vertices to deduplicate. The chunk's unique vertices are
+ * found first, then merged with those of the shape's other chunks to find the chunk each
+ * vertex first appears in. The vertices are numbered in the order they first appear in
+ * the shape, as if the shape was deduplicated serially
+ */
+struct DedupChunk {
+    size_t shape = 0;
+    std::vector<RunSlice> slices;
+    // The index of the chunk's first face vertex in the shape
+    size_t face_vertex_offset = 0;
+
+    // The chunk's unique (position, normal, uv) index triples, in the order they first
+    // appear in the chunk, and the index into them of each of the chunk's face vertices
+    std::vector<glm::uvec3> unique_verts;
+    std::vector<uint32_t> local_indices;
+    // The indices of the unique vertices in each shard, if the shape has multiple chunks
+    std::vector<std::vector<uint32_t>> shard_verts;
+    // Where each unique vertex first appears in the shape, as the dedup chunk index in
+    // the upper 32 bits and the index in its unique vertices in the lower 32 bits
+    std::vector<uint64_t> first_use;
+
+    // The number of vertices, normals and uvs first appearing in this chunk, and the
+    // number first appearing in the shape's chunks before it
+    glm::uvec3 count = glm::uvec3(0);
+    glm::uvec3 offset = glm::uvec3(0);
+    // The index of each unique vertex in the shape's vertices
+    std::vector<uint32_t> vertex_ids;
+};
+
+uint64_t vertex_use(const size_t chunk, const uint32_t local_index)
+{
+    return (uint64_t(chunk) << 32) | local_index;
+}
+
+struct ObjChunk {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+
+    // Number of positions, normals and texcoords in the chunk, and the number
+    // in the file before the chunk
+    glm::uvec3 count = glm::uvec3(0);
+    glm::uvec3 offset = glm::uvec3(0);
+
+    std::vector<ObjRun> runs;
+    std::vector<std::vector<std::string>> mtllibs;
+};
+
+bool is_space(const char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+const char *skip_space(const char *p, const char *end)
+{
+    while (p != end && is_space(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+// Find the end of the line starting at p and the start of the next line
+const char *find_line_end(const char *p, const char *end, const char *&next_line)
+{
+    const char *line_end = static_cast<const char *>(std::memchr(p, '\n', end - p));
+    if (!line_end) {
+        next_line = end;
+        line_end = end;
+    } else {
+        next_line = line_end + 1;
+    }
+    if (line_end != p && *(line_end - 1) == '\r') {
+        --line_end;
+    }
+    return line_end;
+}
+
+bool starts_with(const char *p, const char *end, const char *keyword, const size_t len)
+{
+    return size_t(end - p) > len && std::strncmp(p, keyword, len) == 0 && is_space(p[len]);
+}
+
+// Determine the type of the line and advance p past the line's keyword
+ObjLine classify_line(const char *&p, const char *end)
+{
+    p = skip_space(p, end);
+    if (p == end) {
+        return ObjLine::OTHER;
+    }
+
+    ObjLine type = ObjLine::OTHER;
+    size_t keyword_len = 0;
+    if (starts_with(p, end, "v", 1)) {
+        type = ObjLine::VERTEX;
+        keyword_len = 1;
+    } else if (starts_with(p, end, "vn", 2)) {
+        type = ObjLine::NORMAL;
+        keyword_len = 2;
+    } else if (starts_with(p, end, "vt", 2)) {
+        type = ObjLine::TEXCOORD;
+        keyword_len = 2;
+    } else if (starts_with(p, end, "f", 1)) {
+        type = ObjLine::FACE;
+        keyword_len = 1;
+    } else if (starts_with(p, end, "g", 1)) {
+        type = ObjLine::GROUP;
+        keyword_len = 1;
+    } else if (starts_with(p, end, "o", 1)) {
+        type = ObjLine::OBJECT;
+        keyword_len = 1;
+    } else if (starts_with(p, end, "usemtl", 6)) {
+        type = ObjLine::USEMTL;
+        keyword_len = 6;
+    } else if (starts_with(p, end, "mtllib", 6)) {
+        type = ObjLine::MTLLIB;
+        keyword_len = 6;
+    }
+    p = skip_space(p + keyword_len, end);
+    return type;
+}
+
+float parse_float(const char *&p, const char *end)
+{
+    p = skip_space(p, end);
+    // The mapped file is not null terminated, so copy the token out before parsing it
+    char buf[64];
+    size_t n = 0;
+    while (p != end && !is_space(*p) && n < sizeof(buf) - 1) {
+        buf[n++] = *p++;
+    }
+    buf[n] = '\0';
+    return std::strtof(buf, nullptr);
+}
+
+// Parse a 1-based or negative relative OBJ index, returns 0 if there's no index
+int64_t parse_index(const char *&p, const char *end)
+{
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    int64_t val = 0;
+    while (p != end && *p >= '0' && *p <= '9') {
+        val = val * 10 + (*p - '0');
+        ++p;
+    }
+    return negative ? -val : val;
+}
+
+// Convert an OBJ index to a 0-based index given the number of elements seen so far
+uint32_t fix_index(const int64_t idx, const uint32_t count)
+{
+    if (idx > 0) {
+        return idx - 1;
+    }
+    return count + idx;
+}
+
+std::string parse_name(const char *p, const char *end)
+{
+    while (end != p && is_space(*(end - 1))) {
+        --end;
+    }
+    return std::string(p, end);
+}
+
+void count_chunk_elements(ObjChunk &chunk)
+{
+    const char *next_line = chunk.begin;
+    for (const char *p = chunk.begin; p != chunk.end; p = next_line) {
+        const char *line_end = find_line_end(p, chunk.end, next_line);
+        switch (classify_line(p, line_end)) {
+        case ObjLine::VERTEX:
+            ++chunk.count.x;
+            break;
+        case ObjLine::NORMAL:
+            ++chunk.count.y;
+            break;
+        case ObjLine::TEXCOORD:
+            ++chunk.count.z;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void parse_chunk(ObjChunk &chunk,
+                 std::vector<glm::vec3> &positions,
+                 std::vector<glm::vec3> &normals,
+                 std::vector<glm::vec2> &texcoords)
+{
+    // Running count of the elements seen in the file, used to resolve relative indices
+    glm::uvec3 seen = chunk.offset;
+    chunk.runs.emplace_back();
+    std::vector<glm::uvec3> face;
+
+    const char *next_line = chunk.begin;
+    for (const char *p = chunk.begin; p != chunk.end; p = next_line) {
+        const char *line_end = find_line_end(p, chunk.end, next_line);
+        switch (classify_line(p, line_end)) {
+        case ObjLine::VERTEX: {
+            glm::vec3 &v = positions[seen.x++];
+            v.x = parse_float(p, line_end);
+            v.y = parse_float(p, line_end);
+            v.z = parse_float(p, line_end);
+            break;
+        }
+        case ObjLine::NORMAL: {
+            glm::vec3 &n = normals[seen.y++];
+            n.x = parse_float(p, line_end);
+            n.y = parse_float(p, line_end);
+            n.z = parse_float(p, line_end);
+            break;
+        }
+        case ObjLine::TEXCOORD: {
+            glm::vec2 &t = texcoords[seen.z++];
+            t.x = parse_float(p, line_end);
+            t.y = parse_float(p, line_end);
+            break;
+        }
+        case ObjLine::FACE: {
+            face.clear();
+            while (p != line_end) {
+                // Vertices are written as v, v/vt, v//vn or v/vt/vn
+                glm::uvec3 idx(-1);
+                const int64_t v = parse_index(p, line_end);
+                if (v == 0) {
+                    throw std::runtime_error(
+                        "Failed to parse OBJ face: zero or missing index");
+                }
+                idx.x = fix_index(v, seen.x);
+                if (p != line_end && *p == '/') {
+                    ++p;
+                    const int64_t vt = parse_index(p, line_end);
+                    if (vt != 0) {
+                        idx.z = fix_index(vt, seen.z);
+                    }
+                    if (p != line_end && *p == '/') {
+                        ++p;
+                        const int64_t vn = parse_index(p, line_end);
+                        if (vn != 0) {
+                            idx.y = fix_index(vn, seen.y);
+                        }
+                    }
+                }
+                face.push_back(idx);
+                // Skip anything else remaining in the vertex
+                while (p != line_end && !is_space(*p)) {
+                    ++p;
+                }
+                p = skip_space(p, line_end);
+            }
+            // Fan triangulate the face, faces with fewer than 3 vertices are skipped
+            auto &verts = chunk.runs.back().verts;
+            for (size_t i = 2; i < face.size(); ++i) {
+                verts.push_back(face[0]);
+                verts.push_back(face[i - 1]);
+                verts.push_back(face[i]);
+            }
+            break;
+        }
+        case ObjLine::GROUP:
+        case ObjLine::OBJECT: {
+            ObjRun run;
+            run.new_shape = true;
+            run.name = parse_name(p, line_end);
+            chunk.runs.push_back(run);
+            break;
+        }
+        case ObjLine::USEMTL: {
+            ObjRun run;
+            run.set_material = true;
+            run.material = parse_name(p, line_end);
+            chunk.runs.push_back(run);
+            break;
+        }
+        case ObjLine::MTLLIB: {
+            std::vector<std::string> files;
+            while (p != line_end) {
+                const char *name_end = p;
+                while (name_end != line_end && !is_space(*name_end)) {
+                    ++name_end;
+                }
+                files.emplace_back(p, name_end);
+                p = skip_space(name_end, line_end);
+            }
+            chunk.mtllibs.push_back(files);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+}
+
+ObjModel load_obj_parallel(const std::string &file, std::string &warn)
+{
+    ObjModel model;
+
+    FileMapping mapping(file);
+    const char *file_begin = reinterpret_cast<const char *>(mapping.data());
+    const char *file_end = file_begin + mapping.nbytes();
+
+    // Split the file into a chunk per-thread, with each chunk starting at the beginning
+    // of a line
+    const size_t num_chunks = std::max(
+        size_t(1),
+        std::min(size_t(std::max(std::thread::hardware_concurrency(), 1u)),
+                 mapping.nbytes() / (1024 * 1024)));
+    std::vector<ObjChunk> chunks;
+    const char *chunk_begin = file_begin;
+    for (size_t i = 0; i < num_chunks && chunk_begin != file_end; ++i) {
+        const char *chunk_end = file_end;
+        if (i + 1 < num_chunks) {
+            chunk_end = std::max(chunk_begin,
+                                 file_begin + (i + 1) * (mapping.nbytes() / num_chunks));
+            find_line_end(chunk_end, file_end, chunk_end);
+        }
+        ObjChunk chunk;
+        chunk.begin = chunk_begin;
+        chunk.end = chunk_end;
+        chunks.push_back(chunk);
+        chunk_begin = chunk_end;
+    }
+
+    // Count the vertex data in each chunk so that we know where each chunk will write
+    // its data, and how to resolve relative indices
+    parallel_for(chunks.size(), [&](size_t i) { count_chunk_elements(chunks[i]); });
+    glm::uvec3 total(0);
+    for (auto &c : chunks) {
+        c.offset = total;
+        total += c.count;
+    }
+
+    std::vector<glm::vec3> positions(total.x);
+    std::vector<glm::vec3> normals(total.y);
+    std::vector<glm::vec2> texcoords(total.z);
+    parallel_for(chunks.size(),
+                 [&](size_t i) { parse_chunk(chunks[i], positions, normals, texcoords); });
+
+    // Load any materials referenced, trying each file listed in an mtllib statement
+    // until one can be loaded like tinyobjloader
+    const std::string obj_base_dir = file.substr(0, file.rfind('/'));
+    std::map<std::string, int> material_map;
+    tinyobj::MaterialFileReader mtl_reader(obj_base_dir + "/");
+    for (const auto &c : chunks) {
+        for (const auto &mtllib : c.mtllibs) {
+            bool found = false;
+            for (const auto &mtl_file : mtllib) {
+                model.mtl_files.push_back(obj_base_dir + "/" + mtl_file);
+                std::string mtl_err;
+                if (mtl_reader(mtl_file, &model.materials, &material_map, &warn, &mtl_err)) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                warn += "Failed to load material file(s). Use default material.\n";
+            }
+        }
+    }
+
+    // Stitch the runs from each chunk together into shapes
+    struct ShapeRuns {
+        std::string name;
+        std::vector<const ObjRun *> runs;
+        std::vector<int32_t> material_ids;
+    };
+    std::vector<ShapeRuns> shape_runs;
+    ShapeRuns current_shape;
+    int32_t material_id = -1;
+    for (const auto &c : chunks) {
+        for (const auto &r : c.runs) {
+            if (r.new_shape) {
+                if (!current_shape.runs.empty()) {
+                    shape_runs.push_back(current_shape);
+                }
+                current_shape = ShapeRuns();
+                current_shape.name = r.name;
+            }
+            if (r.set_material) {
+                auto fnd = material_map.find(r.material);
+                material_id = fnd != material_map.end() ? fnd->second : -1;
+            }
+            if (!r.verts.empty()) {
+                current_shape.runs.push_back(&r);
+                current_shape.material_ids.push_back(material_id);
+            }
+        }
+    }
+    if (!current_shape.runs.empty()) {
+        shape_runs.push_back(current_shape);
+    }
+
+    // Remap from the 3 indices per-vertex (independent for pos, normal & uv) used by OBJ
+    // to a single index per-vertex (single for pos, normal & uv tuple) used by renderers.
+    // Split the shapes into chunks to deduplicate their vertices in parallel
+    std::vector<DedupChunk> dedup_chunks;
+    std::vector<size_t> shape_chunks(shape_runs.size() + 1, 0);
+    std::vector<size_t> shape_face_vertices(shape_runs.size(), 0);
+    for (size_t s = 0; s < shape_runs.size(); ++s) {
+        shape_chunks[s] = dedup_chunks.size();
+        DedupChunk chunk;
+        chunk.shape = s;
+        size_t chunk_verts = 0;
+        for (const auto *r : shape_runs[s].runs) {
+            for (size_t begin = 0; begin < r->verts.size();) {
+                const size_t end =
+                    std::min(r->verts.size(), begin + DEDUP_CHUNK_VERTS - chunk_verts);
+                RunSlice slice;
+                slice.run = r;
+                slice.begin = begin;
+                slice.end = end;
+                chunk.slices.push_back(slice);
+                chunk_verts += end - begin;
+                begin = end;
+                if (chunk_verts == DEDUP_CHUNK_VERTS) {
+                    dedup_chunks.push_back(std::move(chunk));
+                    chunk = DedupChunk();
+                    chunk.shape = s;
+                    chunk.face_vertex_offset = shape_face_vertices[s] + chunk_verts;
+                    shape_face_vertices[s] += chunk_verts;
+                    chunk_verts = 0;
+                }
+            }
+        }
+        if (!chunk.slices.empty()) {
+            dedup_chunks.push_back(std::move(chunk));
+            shape_face_vertices[s] += chunk_verts;
+        }
+    }
+    shape_chunks[shape_runs.size()] = dedup_chunks.size();
+
+    // Find the unique vertices in each chunk
+    parallel_for(dedup_chunks.size(), [&](size_t c) {
+        DedupChunk &chunk = dedup_chunks[c];
+        const bool merged = shape_chunks[chunk.shape + 1] - shape_chunks[chunk.shape] > 1;
+        if (merged) {
+            chunk.shard_verts.resize(DEDUP_SHARDS);
+        }
+        phmap::flat_hash_map<glm::uvec3, uint32_t, UVec3Hash> index_mapping;
+        for (const auto &slice : chunk.slices) {
+            for (size_t i = slice.begin; i < slice.end; ++i) {
+                const glm::uvec3 &idx = slice.run->verts[i];
+                uint32_t local_idx = 0;
+                auto fnd = index_mapping.find(idx);
+                if (fnd != index_mapping.end()) {
+                    local_idx = fnd->second;
+                } else {
+                    if (idx.x >= positions.size() ||
+                        (idx.y != uint32_t(-1) && idx.y >= normals.size()) ||
+                        (idx.z != uint32_t(-1) && idx.z >= texcoords.size())) {
+                        throw std::runtime_error("Out of bounds index in OBJ shape " +
+                                                 shape_runs[chunk.shape].name);
+                    }
+                    local_idx = chunk.unique_verts.size();
+                    index_mapping[idx] = local_idx;
+                    chunk.unique_verts.push_back(idx);
+                    if (merged) {
+                        const size_t hash = UVec3Hash()(idx);
+                        const size_t shard = hash >> (sizeof(size_t) * 8 - DEDUP_SHARD_BITS);
+                        chunk.shard_verts[shard].push_back(local_idx);
+                    }
+                }
+                chunk.local_indices.push_back(local_idx);
+            }
+        }
+        // Until merged with the shape's other chunks, each vertex first appears here
+        chunk.first_use.resize(chunk.unique_verts.size());
+        for (uint32_t i = 0; i < chunk.unique_verts.size(); ++i) {
+            chunk.first_use[i] = vertex_use(c, i);
+        }
+    });
+
+    // Merge the unique vertices of the shapes split into multiple chunks, each shard of
+    // a shape finds the first chunk each of its vertices appears in
+    std::vector<size_t> merged_shapes;
+    for (size_t s = 0; s < shape_runs.size(); ++s) {
+        if (shape_chunks[s + 1] - shape_chunks[s] > 1) {
+            merged_shapes.push_back(s);
+        }
+    }
+    parallel_for(merged_shapes.size() * DEDUP_SHARDS, [&](size_t i) {
+        const size_t s = merged_shapes[i / DEDUP_SHARDS];
+        const size_t shard = i % DEDUP_SHARDS;
+        phmap::flat_hash_map<glm::uvec3, uint64_t, UVec3Hash> first_use;
+        for (size_t c = shape_chunks[s]; c < shape_chunks[s + 1]; ++c) {
+            DedupChunk &chunk = dedup_chunks[c];
+            for (const uint32_t v : chunk.shard_verts[shard]) {
+                auto res = first_use.emplace(chunk.unique_verts[v], chunk.first_use[v]);
+                chunk.first_use[v] = res.first->second;
+            }
+        }
+    });
+
+    // Count the vertices first appearing in each chunk, a prefix sum over each shape's
+    // chunks then gives the index of each chunk's first new vertex, normal and uv
+    parallel_for(dedup_chunks.size(), [&](size_t c) {
+        DedupChunk &chunk = dedup_chunks[c];
+        for (uint32_t i = 0; i < chunk.unique_verts.size(); ++i) {
+            if (chunk.first_use[i] == vertex_use(c, i)) {
+                const glm::uvec3 &idx = chunk.unique_verts[i];
+                chunk.count.x += 1;
+                chunk.count.y += idx.y != uint32_t(-1) ? 1 : 0;
+                chunk.count.z += idx.z != uint32_t(-1) ? 1 : 0;
+            }
+        }
+    });
+    std::vector<glm::uvec3> shape_counts(shape_runs.size(), glm::uvec3(0));
+    for (auto &chunk : dedup_chunks) {
+        chunk.offset = shape_counts[chunk.shape];
+        shape_counts[chunk.shape] += chunk.count;
+    }
+
+    model.shapes.resize(shape_runs.size());
+    for (size_t s = 0; s < shape_runs.size(); ++s) {
+        const ShapeRuns &runs = shape_runs[s];
+        ObjShape &shape = model.shapes[s];
+        shape.name = runs.name;
+        shape.material_id = runs.material_ids[0];
+        shape.mixed_materials =
+            std::find_if(runs.material_ids.begin(),
+                         runs.material_ids.end(),
+                         [&](const int32_t id) { return id != shape.material_id; }) !=
+            runs.material_ids.end();
+    }
+
+    struct ShapeBuffers {
+        std::vector<glm::vec3> vertices, normals;
+        std::vector<glm::vec2> uvs;
+        std::vector<glm::uvec3> indices;
+    };
+    std::vector<ShapeBuffers> shape_buffers(shape_runs.size());
+    parallel_for(shape_runs.size(), [&](size_t s) {
+        ShapeBuffers &buffers = shape_buffers[s];
+        buffers.vertices.resize(shape_counts[s].x);
+        buffers.normals.resize(shape_counts[s].y);
+        buffers.uvs.resize(shape_counts[s].z);
+        buffers.indices.resize(shape_face_vertices[s] / 3);
+    });
+
+    // Number the vertices first appearing in each chunk and write out their data
+    parallel_for(dedup_chunks.size(), [&](size_t c) {
+        DedupChunk &chunk = dedup_chunks[c];
+        ShapeBuffers &buffers = shape_buffers[chunk.shape];
+        chunk.vertex_ids.resize(chunk.unique_verts.size());
+        glm::uvec3 next = chunk.offset;
+        for (uint32_t i = 0; i < chunk.unique_verts.size(); ++i) {
+            if (chunk.first_use[i] != vertex_use(c, i)) {
+                continue;
+            }
+            const glm::uvec3 &idx = chunk.unique_verts[i];
+            chunk.vertex_ids[i] = next.x;
+            buffers.vertices[next.x++] = positions[idx.x];
+            if (idx.y != uint32_t(-1)) {
+                buffers.normals[next.y++] = glm::normalize(normals[idx.y]);
+            }
+            if (idx.z != uint32_t(-1)) {
+                buffers.uvs[next.z++] = texcoords[idx.z];
+            }
+        }
+    });
+
+    // Look up the indices of the vertices which first appeared in earlier chunks and
+    // write out the chunks' faces
+    parallel_for(dedup_chunks.size(), [&](size_t c) {
+        DedupChunk &chunk = dedup_chunks[c];
+        for (uint32_t i = 0; i < chunk.unique_verts.size(); ++i) {
+            const uint64_t use = chunk.first_use[i];
+            if (use != vertex_use(c, i)) {
+                chunk.vertex_ids[i] = dedup_chunks[use >> 32].vertex_ids[uint32_t(use)];
+            }
+        }
+        ShapeBuffers &buffers = shape_buffers[chunk.shape];
+        for (size_t i = 0; i < chunk.local_indices.size(); ++i) {
+            const size_t face_vertex = chunk.face_vertex_offset + i;
+            buffers.indices[face_vertex / 3][face_vertex % 3] =
+                chunk.vertex_ids[chunk.local_indices[i]];
+        }
+    });
+
+    for (size_t s = 0; s < shape_runs.size(); ++s) {
+        Geometry &geom = model.shapes[s].geometry;
+        geom.vertices = std::move(shape_buffers[s].vertices);
+        geom.normals = std::move(shape_buffers[s].normals);
+        geom.uvs = std::move(shape_buffers[s].uvs);
+        geom.indices = std::move(shape_buffers[s].indices);
+    }
+
+    return model;
+}
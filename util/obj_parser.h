@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "mesh.h"
+#include "tiny_obj_loader.h"
+
+struct ObjShape {
+    std::string name;
+    // The shape's geometry, with the (position, normal, uv) index triples used by the
+    // OBJ file remapped to a single index per-vertex
+    Geometry geometry;
+    // The material used by the first face in the shape, -1 if none
+    int32_t material_id = -1;
+    // Set if faces in the shape use different materials
+    bool mixed_materials = false;
+};
+
+struct ObjModel {
+    std::vector<ObjShape> shapes;
+    std::vector<tinyobj::material_t> materials;
+    // The MTL files which were tried when loading the materials
+    std::vector<std::string> mtl_files;
+};
+
+/* Load an OBJ file in parallel. The file is mapped into memory and split at line
+ * boundaries into one chunk per-thread which are parsed in parallel, after which the
+ * vertices of each shape are de-duplicated in parallel. Shapes are split on g and o
+ * statements following tinyobjloader, and polygons are fan triangulated. Materials
+ * are loaded from any MTL files referenced relative to the OBJ file using tinyobjloader.
+ */
+ObjModel load_obj_parallel(const std::string &file, std::string &warn);
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Run fn(i) for each i in [0, n) across the hardware threads available. Indices are
+ * handed out to threads dynamically one at a time, so this is meant for coarse grained
+ * work items (a chunk of a file, a shape, a texture). If any call to fn throws, the first
+ * exception thrown is rethrown on the calling thread once all threads have finished.
+ */
+template <typename F>
+void parallel_for(const size_t n, const F &fn)
+{
+    const size_t num_threads =
+        std::min(size_t(std::max(std::thread::hardware_concurrency(), 1u)), n);
+    if (num_threads <= 1) {
+        for (size_t i = 0; i < n; ++i) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next_index(0);
+    std::exception_ptr error = nullptr;
+    std::mutex error_mutex;
+    auto worker = [&]() {
+        for (size_t i = next_index++; i < n; i = next_index++) {
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                // Skip any remaining work
+                next_index = n;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
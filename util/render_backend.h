@@ -1,5 +1,7 @@
 #pragma once
 
+#include <memory>
+#include <string>
 #include <vector>
 #include "scene.h"
 #include <glm/glm.hpp>
@@ -7,21 +9,76 @@
 struct RenderStats {
     float render_time = 0;
     float rays_per_second = 0;
+    // The average samples accumulated per pixel, reported by backends which vary the
+    // samples taken each frame
+    float samples_per_pixel = 0;
+    /* The quality the frame was rendered at, for backends which lower the quality while
+     * the camera is moving: the fraction of the framebuffer resolution rendered and the
+     * maximum path depth
+     */
+    bool interactive_quality = false;
+    float render_scale = 1;
+    uint32_t max_path_depth = 0;
 };
 
-struct RenderBackend {
+/* Backends can start setting up the scene before it's finished loading by overriding the
+ * SceneListener methods, see SceneListener for what the setup can overlap. The scene is
+ * loaded between calls to begin_scene and end_scene, with the backend passed as the
+ * scene's listener.
+ */
+struct RenderBackend : SceneListener {
     std::vector<uint32_t> img;
     uint32_t samples_per_pixel = 1;
+    /* The target render time for each frame in ms, or 0 to take samples_per_pixel samples
+     * each frame. Backends which support a frame budget pick the samples to take each
+     * frame to fit in the budget instead, and weight the frames by their samples
+     */
+    float frame_budget_ms = 0;
 
     virtual ~RenderBackend() {}
 
     virtual std::string name() = 0;
 
+    /* Parse a backend specific command line option at args[i], advancing i past any
+     * values taken by the option. Returns false if the option isn't one of the backend's
+     */
+    virtual bool parse_arg(const std::vector<std::string> &, size_t &)
+    {
+        return false;
+    }
+
     virtual void initialize(const int fb_width, const int fb_height) = 0;
 
-    // TODO Probably should take the scene through a shared_ptr
+    // The number of levels of instancing the backend supports. Scenes using more levels
+    // are flattened to single level instancing before being passed to set_scene
+    virtual size_t max_instance_levels() const
+    {
+        return 1;
+    }
+
+    // Set the scene to render. The backend must copy any scene data it needs to keep
     virtual void set_scene(const Scene &scene) = 0;
 
+    /* Set the scene to render, sharing ownership of the scene with the backend. Backends
+     * can keep the scene to use its data in place instead of copying it. By default this
+     * calls set_scene(const Scene &)
+     */
+    virtual void set_scene(std::shared_ptr<const Scene> scene)
+    {
+        set_scene(*scene);
+    }
+
+    // Called before loading a scene which will be streamed to the backend
+    virtual void begin_scene() {}
+
+    /* Called with the loaded scene once a scene streamed to the backend has finished
+     * loading, to finish setting it up. By default this calls set_scene
+     */
+    virtual void end_scene(std::shared_ptr<const Scene> scene)
+    {
+        set_scene(scene);
+    }
+
     // Returns the rays per-second achieved, or -1 if this is not tracked
     virtual RenderStats render(const glm::vec3 &pos,
                                const glm::vec3 &dir,
@@ -1,15 +1,24 @@
 #include "scene.h"
 #include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <set>
+#include <sstream>
+#include <map>
 #include <numeric>
 #include <stdexcept>
 #include <vector>
 #include "buffer_view.h"
 #include "file_mapping.h"
-#include "flatten_gltf.h"
 #include "gltf_types.h"
 #include "json.hpp"
+#include "obj_parser.h"
+#include "parallel_for.h"
 #include "phmap_utils.h"
+#include "scene_cache.h"
 #include "stb_image.h"
 #include "tiny_gltf.h"
 #include "tiny_obj_loader.h"
@@ -46,9 +55,22 @@ bool operator==(const glm::uvec3 &a, const glm::uvec3 &b)
     return a.x == b.x && a.y == b.y && a.z == b.z;
 }
 
-Scene::Scene(const std::string &fname, MaterialMode material_mode)
+Scene::Scene(const std::string &fname,
+             MaterialMode material_mode,
+             bool use_cache,
+             SceneListener *listener)
     : material_mode(material_mode)
 {
+    if (use_cache && load_scene_cache(fname, *this)) {
+        if (listener) {
+            send_geometry(*listener);
+            for (size_t i = 0; i < textures.size(); ++i) {
+                listener->add_texture(i, textures[i]);
+            }
+        }
+        return;
+    }
+
     const std::string ext = get_file_extension(fname);
     if (ext == "obj") {
         load_obj(fname);
@@ -64,6 +86,19 @@ Scene::Scene(const std::string &fname, MaterialMode material_mode)
         std::cout << "Unsupported file '" << fname << "'\n";
         throw std::runtime_error("Unsupported file " + fname);
     }
+    prune_unreferenced();
+    deduplicate_geometry();
+    pad_vertex_buffers();
+    // The geometry is final now, so the listener can start working on it while the
+    // textures are decoded and the cache is written
+    if (listener) {
+        send_geometry(*listener);
+    }
+    decode_textures(listener);
+
+    if (use_cache) {
+        write_scene_cache(fname, *this);
+    }
 }
 
 size_t Scene::unique_tris() const
@@ -74,13 +109,33 @@ size_t Scene::unique_tris() const
         });
 }
 
+// Count the triangles placed by the instances, and by the instances of groups
+size_t instanced_tris(const Scene &scene,
+                      const std::vector<Instance> &instances,
+                      const std::vector<GroupInstance> &group_instances,
+                      std::vector<size_t> &group_tris)
+{
+    size_t n = 0;
+    for (const auto &i : instances) {
+        n += scene.meshes[scene.parameterized_meshes[i.parameterized_mesh_id].mesh_id]
+                 .num_tris();
+    }
+    for (const auto &g : group_instances) {
+        // Groups may be instanced many times, so the count for each group is computed once
+        if (group_tris[g.group_id] == size_t(-1)) {
+            const InstanceGroup &group = scene.instance_groups[g.group_id];
+            group_tris[g.group_id] =
+                instanced_tris(scene, group.instances, group.group_instances, group_tris);
+        }
+        n += group_tris[g.group_id];
+    }
+    return n;
+}
+
 size_t Scene::total_tris() const
 {
-    return std::accumulate(
-        instances.begin(), instances.end(), 0, [&](const size_t &n, const Instance &i) {
-            return n +
-                   meshes[parameterized_meshes[i.parameterized_mesh_id].mesh_id].num_tris();
-        });
+    std::vector<size_t> group_tris(instance_groups.size(), -1);
+    return instanced_tris(*this, instances, group_instances, group_tris);
 }
 
 size_t Scene::num_geometries() const
@@ -91,93 +146,97 @@ size_t Scene::num_geometries() const
         });
 }
 
+size_t Scene::num_instances() const
+{
+    return std::accumulate(instance_groups.begin(),
+                           instance_groups.end(),
+                           instances.size() + group_instances.size(),
+                           [](const size_t &n, const InstanceGroup &g) {
+                               return n + g.instances.size() + g.group_instances.size();
+                           });
+}
+
+// Compute the levels of instancing used by the instances and instances of groups
+size_t instancing_levels(const Scene &scene,
+                         const std::vector<Instance> &instances,
+                         const std::vector<GroupInstance> &group_instances,
+                         std::vector<size_t> &group_levels)
+{
+    size_t levels = instances.empty() ? 0 : 1;
+    for (const auto &g : group_instances) {
+        if (group_levels[g.group_id] == size_t(-1)) {
+            const InstanceGroup &group = scene.instance_groups[g.group_id];
+            group_levels[g.group_id] =
+                instancing_levels(scene, group.instances, group.group_instances, group_levels);
+        }
+        levels = std::max(levels, group_levels[g.group_id] + 1);
+    }
+    return levels;
+}
+
+size_t Scene::instance_levels() const
+{
+    std::vector<size_t> group_levels(instance_groups.size(), -1);
+    return std::max(instancing_levels(*this, instances, group_instances, group_levels),
+                    size_t(1));
+}
+
+// Append the instances placed by the instance group with the transform to flattened
+void flatten_instance_group(const std::vector<InstanceGroup> &groups,
+                            const size_t group_id,
+                            const glm::mat4 &transform,
+                            std::vector<Instance> &flattened)
+{
+    const InstanceGroup &group = groups[group_id];
+    for (const auto &i : group.instances) {
+        flattened.emplace_back(transform * i.transform, i.parameterized_mesh_id);
+    }
+    for (const auto &g : group.group_instances) {
+        flatten_instance_group(groups, g.group_id, transform * g.transform, flattened);
+    }
+}
+
+void Scene::flatten_instances()
+{
+    for (const auto &g : group_instances) {
+        flatten_instance_group(instance_groups, g.group_id, g.transform, instances);
+    }
+    group_instances.clear();
+    instance_groups.clear();
+}
+
 void Scene::load_obj(const std::string &file)
 {
     std::cout << "Loading OBJ: " << file << "\n";
 
-    // Load the model w/ tinyobjloader. We just take any OBJ groups etc. stuff
-    // that may be in the file and dump them all into a single OBJ model.
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> obj_materials;
-    std::string err, warn;
-    const std::string obj_base_dir = file.substr(0, file.rfind('/'));
-    bool ret = tinyobj::LoadObj(
-        &attrib, &shapes, &obj_materials, &warn, &err, file.c_str(), obj_base_dir.c_str());
+    // Parse the model in parallel, each OBJ group or object becomes a geometry in the
+    // single mesh we load the file as
+    std::string warn;
+    ObjModel model = load_obj_parallel(file, warn);
     if (!warn.empty()) {
-        std::cout << "TinyOBJ loading '" << file << "': " << warn << "\n";
-    }
-    if (!ret || !err.empty()) {
-        throw std::runtime_error("TinyOBJ Error loading " + file + " error: " + err);
+        std::cout << "OBJ loading '" << file << "': " << warn << "\n";
     }
+    dependencies.insert(dependencies.end(), model.mtl_files.begin(), model.mtl_files.end());
+    const std::vector<tinyobj::material_t> &obj_materials = model.materials;
+    const std::string obj_base_dir = file.substr(0, file.rfind('/'));
 
     Mesh mesh;
     std::vector<uint32_t> material_ids;
-    for (size_t s = 0; s < shapes.size(); ++s) {
-        // We load with triangulate on so we know the mesh will be all triangle faces
-        const tinyobj::mesh_t &obj_mesh = shapes[s].mesh;
-
-        // We've got to remap from 3 indices per-vert (independent for pos, normal & uv) used
-        // by tinyobjloader over to single index per-vert (single for pos, normal & uv tuple)
-        // used by renderers
-        phmap::parallel_flat_hash_map<glm::uvec3, uint32_t> index_mapping;
-        Geometry geom;
+    for (auto &shape : model.shapes) {
         // Note: not supporting per-primitive materials
         if (material_mode == MaterialMode::DEFAULT) {
-            material_ids.push_back(obj_mesh.material_ids[0]);
+            material_ids.push_back(shape.material_id);
         } else {
             material_ids.push_back(-1);
         }
 
-        auto minmax_matid =
-            std::minmax_element(obj_mesh.material_ids.begin(), obj_mesh.material_ids.end());
-        if (*minmax_matid.first != *minmax_matid.second) {
+        if (shape.mixed_materials) {
             std::cout
                 << "Warning: per-face material IDs are not supported, materials may look "
                    "wrong."
                    " Please reexport your mesh with each material group as an OBJ group\n";
         }
-
-        for (size_t f = 0; f < obj_mesh.num_face_vertices.size(); ++f) {
-            if (obj_mesh.num_face_vertices[f] != 3) {
-                throw std::runtime_error("Non-triangle face found in " + file + "-" +
-                                         shapes[s].name);
-            }
-
-            glm::uvec3 tri_indices;
-            for (size_t i = 0; i < 3; ++i) {
-                const glm::uvec3 idx(obj_mesh.indices[f * 3 + i].vertex_index,
-                                     obj_mesh.indices[f * 3 + i].normal_index,
-                                     obj_mesh.indices[f * 3 + i].texcoord_index);
-                uint32_t vert_idx = 0;
-                auto fnd = index_mapping.find(idx);
-                if (fnd != index_mapping.end()) {
-                    vert_idx = fnd->second;
-                } else {
-                    vert_idx = geom.vertices.size();
-                    index_mapping[idx] = vert_idx;
-
-                    geom.vertices.emplace_back(attrib.vertices[3 * idx.x],
-                                               attrib.vertices[3 * idx.x + 1],
-                                               attrib.vertices[3 * idx.x + 2]);
-
-                    if (idx.y != uint32_t(-1)) {
-                        glm::vec3 n(attrib.normals[3 * idx.y],
-                                    attrib.normals[3 * idx.y + 1],
-                                    attrib.normals[3 * idx.y + 2]);
-                        geom.normals.push_back(glm::normalize(n));
-                    }
-
-                    if (idx.z != uint32_t(-1)) {
-                        geom.uvs.emplace_back(attrib.texcoords[2 * idx.z],
-                                              attrib.texcoords[2 * idx.z + 1]);
-                    }
-                }
-                tri_indices[i] = vert_idx;
-            }
-            geom.indices.push_back(tri_indices);
-        }
-        mesh.geometries.push_back(geom);
+        mesh.geometries.push_back(std::move(shape.geometry));
     }
     meshes.push_back(mesh);
 
@@ -201,8 +260,12 @@ void Scene::load_obj(const std::string &file)
                 std::string path = m.diffuse_texname;
                 canonicalize_path(path);
                 if (texture_ids.find(m.diffuse_texname) == texture_ids.end()) {
-                    texture_ids[m.diffuse_texname] = textures.size();
-                    textures.emplace_back(obj_base_dir + "/" + path, m.diffuse_texname, SRGB);
+                    const std::string tex_file = obj_base_dir + "/" + path;
+                    dependencies.push_back(tex_file);
+                    texture_ids[m.diffuse_texname] =
+                        add_deferred_texture(m.diffuse_texname, SRGB, [tex_file](Image &img) {
+                            img.decode(tex_file, true);
+                        });
                 }
                 const int32_t id = texture_ids[m.diffuse_texname];
                 uint32_t tex_mask = TEXTURED_PARAM_MASK;
@@ -227,12 +290,141 @@ void Scene::load_obj(const std::string &file)
     lights.push_back(light);
 }
 
+/* tinygltf image loader which keeps the encoded image data instead of decoding it, so
+ * that the images can be decoded in parallel after loading the file
+ */
+bool store_gltf_image(tinygltf::Image *image,
+                      const int image_idx,
+                      std::string *err,
+                      std::string *,
+                      int,
+                      int,
+                      const unsigned char *bytes,
+                      int size,
+                      void *)
+{
+    int x, y, n;
+    if (!stbi_info_from_memory(bytes, size, &x, &y, &n)) {
+        if (err) {
+            *err += "Unknown image format for image[" + std::to_string(image_idx) +
+                    "] name = \"" + image->name + "\"\n";
+        }
+        return false;
+    }
+    // Images are decoded to 4 channel 8-bit images
+    image->width = x;
+    image->height = y;
+    image->component = 4;
+    image->bits = 8;
+    image->pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+    image->as_is = true;
+    image->image = std::vector<unsigned char>(bytes, bytes + size);
+    return true;
+}
+
+glm::mat4 read_node_transform(const tinygltf::Node &n)
+{
+    glm::mat4 transform(1.f);
+    if (!n.matrix.empty()) {
+        transform = glm::make_mat4(n.matrix.data());
+    } else {
+        if (!n.scale.empty()) {
+            transform = glm::scale(glm::vec3(n.scale[0], n.scale[1], n.scale[2]));
+        }
+        if (!n.rotation.empty()) {
+            const glm::quat rot =
+                glm::quat(n.rotation[3], n.rotation[0], n.rotation[1], n.rotation[2]);
+            transform = glm::mat4_cast(rot) * transform;
+        }
+        if (!n.translation.empty()) {
+            const glm::mat4 translate = glm::translate(
+                glm::vec3(n.translation[0], n.translation[1], n.translation[2]));
+            transform = translate * transform;
+        }
+    }
+    return transform;
+}
+
+// Build a key identifying the instance group by its contents
+std::string instance_group_key(const InstanceGroup &group)
+{
+    std::string key;
+    auto append = [&](const void *data, const size_t size) {
+        key.append(reinterpret_cast<const char *>(data), size);
+    };
+    const uint64_t counts[2] = {group.instances.size(), group.group_instances.size()};
+    append(counts, sizeof(counts));
+    for (const auto &i : group.instances) {
+        const uint64_t id = i.parameterized_mesh_id;
+        append(&i.transform, sizeof(glm::mat4));
+        append(&id, sizeof(uint64_t));
+    }
+    for (const auto &g : group.group_instances) {
+        const uint64_t id = g.group_id;
+        append(&g.transform, sizeof(glm::mat4));
+        append(&id, sizeof(uint64_t));
+    }
+    return key;
+}
+
+/* Add the instances for the glTF node and its children to the instances of its parent.
+ * The node's mesh is placed with an instance, and its children are placed with an
+ * instance of an instance group made from them. glTF nodes form a tree, so nodes can't
+ * be shared by multiple parents, but subtrees with identical contents (e.g., repeated
+ * copies of a tree model) are found and share the same instance group.
+ */
+void load_gltf_node(const tinygltf::Model &model,
+                    const tinygltf::Node &node,
+                    std::vector<Instance> &instances,
+                    std::vector<GroupInstance> &group_instances,
+                    std::vector<InstanceGroup> &instance_groups,
+                    std::unordered_map<std::string, size_t> &unique_groups)
+{
+    const glm::mat4 transform = read_node_transform(node);
+    // Note: GLTF "mesh" == ChameleonRT "parameterized mesh", since materials and
+    // meshes are combined in a single entity in GLTF
+    if (node.mesh != -1) {
+        instances.emplace_back(transform, node.mesh);
+    }
+
+    InstanceGroup group;
+    for (const auto &c : node.children) {
+        load_gltf_node(model,
+                       model.nodes[c],
+                       group.instances,
+                       group.group_instances,
+                       instance_groups,
+                       unique_groups);
+    }
+
+    // Groups with a single instance in them aren't worth the extra level of instancing,
+    // so the instance is placed directly in the parent
+    if (group.instances.size() + group.group_instances.size() <= 1) {
+        for (const auto &i : group.instances) {
+            instances.emplace_back(transform * i.transform, i.parameterized_mesh_id);
+        }
+        for (const auto &g : group.group_instances) {
+            group_instances.emplace_back(transform * g.transform, g.group_id);
+        }
+        return;
+    }
+
+    const std::string key = instance_group_key(group);
+    auto fnd = unique_groups.find(key);
+    if (fnd == unique_groups.end()) {
+        fnd = unique_groups.emplace(key, instance_groups.size()).first;
+        instance_groups.push_back(std::move(group));
+    }
+    group_instances.emplace_back(transform, fnd->second);
+}
+
 void Scene::load_gltf(const std::string &fname)
 {
     std::cout << "Loading GLTF " << fname << "\n";
 
     tinygltf::Model model;
     tinygltf::TinyGLTF context;
+    context.SetImageLoader(store_gltf_image, nullptr);
     std::string err, warn;
     bool ret = false;
     if (get_file_extension(fname) == "gltf") {
@@ -253,7 +445,27 @@ void Scene::load_gltf(const std::string &fname)
         model.defaultScene = 0;
     }
 
-    flatten_gltf(model);
+    // External buffers and images are loaded relative to the glTF file
+    const size_t dir_end = fname.rfind('/');
+    const std::string gltf_base_dir =
+        dir_end == std::string::npos ? "" : fname.substr(0, dir_end + 1);
+    for (const auto &b : model.buffers) {
+        if (!b.uri.empty() && !tinygltf::IsDataURI(b.uri)) {
+            dependencies.push_back(gltf_base_dir + b.uri);
+        }
+    }
+    for (const auto &img : model.images) {
+        if (!img.uri.empty() && !tinygltf::IsDataURI(img.uri)) {
+            dependencies.push_back(gltf_base_dir + img.uri);
+        }
+    }
+
+    // Primitives which use the same accessors share the geometry data loaded from them,
+    // so that the duplicate geometry can be found by deduplicate_geometry without
+    // comparing the data
+    phmap::parallel_flat_hash_map<int, GeometryBuffer<glm::vec3>> position_buffers;
+    phmap::parallel_flat_hash_map<int, GeometryBuffer<glm::vec2>> uv_buffers;
+    phmap::parallel_flat_hash_map<int, GeometryBuffer<glm::uvec3>> index_buffers;
 
     // Load the meshes. Note: GLTF combines mesh + material parameters into
     // a single entity, so GLTF "meshes" are ChameleonRT "parameterized meshes"
@@ -275,19 +487,30 @@ void Scene::load_gltf(const std::string &fname)
             }
 
             // Note: assumes there is a POSITION (is this required by the gltf spec?)
-            Accessor<glm::vec3> pos_accessor(model.accessors[p.attributes["POSITION"]], model);
-            for (size_t i = 0; i < pos_accessor.size(); ++i) {
-                geom.vertices.push_back(pos_accessor[i]);
+            const int position_id = p.attributes["POSITION"];
+            if (position_buffers.find(position_id) == position_buffers.end()) {
+                Accessor<glm::vec3> pos_accessor(model.accessors[position_id], model);
+                GeometryBuffer<glm::vec3> positions;
+                for (size_t i = 0; i < pos_accessor.size(); ++i) {
+                    positions.push_back(pos_accessor[i]);
+                }
+                position_buffers[position_id] = positions;
             }
+            geom.vertices = position_buffers[position_id];
 
             // Note: GLTF can have multiple texture coordinates used by different textures
             // (owch) I don't plan to support this
             auto fnd = p.attributes.find("TEXCOORD_0");
             if (fnd != p.attributes.end()) {
-                Accessor<glm::vec2> uv_accessor(model.accessors[fnd->second], model);
-                for (size_t i = 0; i < uv_accessor.size(); ++i) {
-                    geom.uvs.push_back(uv_accessor[i]);
+                if (uv_buffers.find(fnd->second) == uv_buffers.end()) {
+                    Accessor<glm::vec2> uv_accessor(model.accessors[fnd->second], model);
+                    GeometryBuffer<glm::vec2> uvs;
+                    for (size_t i = 0; i < uv_accessor.size(); ++i) {
+                        uvs.push_back(uv_accessor[i]);
+                    }
+                    uv_buffers[fnd->second] = uvs;
                 }
+                geom.uvs = uv_buffers[fnd->second];
             }
 
 #if 0
@@ -300,8 +523,10 @@ void Scene::load_gltf(const std::string &fname)
             }
 #endif
 
-            if (model.accessors[p.indices].componentType ==
-                TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
+            if (index_buffers.find(p.indices) != index_buffers.end()) {
+                geom.indices = index_buffers[p.indices];
+            } else if (model.accessors[p.indices].componentType ==
+                       TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
                 Accessor<uint16_t> index_accessor(model.accessors[p.indices], model);
                 for (size_t i = 0; i < index_accessor.size() / 3; ++i) {
                     geom.indices.push_back(glm::uvec3(index_accessor[i * 3],
@@ -320,6 +545,7 @@ void Scene::load_gltf(const std::string &fname)
                 std::cout << "Unsupported index type\n";
                 throw std::runtime_error("Unsupported index component type");
             }
+            index_buffers[p.indices] = geom.indices;
             mesh.geometries.push_back(geom);
         }
         parameterized_meshes.emplace_back(meshes.size(), material_ids);
@@ -327,25 +553,14 @@ void Scene::load_gltf(const std::string &fname)
     }
 
     if (material_mode == MaterialMode::DEFAULT) {
-        // Load images
-        for (const auto &img : model.images) {
-            if (img.component != 4) {
-                std::cout << "WILL: Check non-4 component image support\n";
-            }
-            if (img.pixel_type != TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
-                std::cout << "Non-uchar images are not supported\n";
-                throw std::runtime_error("Unsupported image pixel type");
-            }
-
-            Image texture;
-            texture.name = img.name;
-            texture.width = img.width;
-            texture.height = img.height;
-            texture.channels = img.component;
-            texture.img = img.image;
+        // Load images, the images are still encoded (see store_gltf_image) and are
+        // decoded in parallel once the scene is loaded
+        for (auto &img : model.images) {
+            auto encoded = std::make_shared<std::vector<uint8_t>>(std::move(img.image));
             // Assume linear unless we find it used as a color texture
-            texture.color_space = LINEAR;
-            textures.push_back(texture);
+            add_deferred_texture(img.name, LINEAR, [encoded](Image &texture) {
+                texture.decode(encoded->data(), encoded->size(), false);
+            });
         }
 
         // Load materials
@@ -389,14 +604,15 @@ void Scene::load_gltf(const std::string &fname)
         }
     }
 
+    // Load the node hierarchy as instance groups, instead of flattening it
+    std::unordered_map<std::string, size_t> unique_groups;
     for (const auto &nid : model.scenes[model.defaultScene].nodes) {
-        const tinygltf::Node &n = model.nodes[nid];
-        if (n.mesh != -1) {
-            const glm::mat4 transform = read_node_transform(n);
-            // Note: GLTF "mesh" == ChameleonRT "parameterized mesh", since materials and
-            // meshes are combined in a single entity in GLTF
-            instances.emplace_back(transform, n.mesh);
-        }
+        load_gltf_node(model,
+                       model.nodes[nid],
+                       instances,
+                       group_instances,
+                       instance_groups,
+                       unique_groups);
     }
 
     validate_materials();
@@ -414,6 +630,23 @@ void Scene::load_gltf(const std::string &fname)
     lights.push_back(light);
 }
 
+/* Reference the data viewed by the accessor directly if it's aligned for T, keeping the
+ * mapped file alive. Otherwise the data is copied into the buffer.
+ */
+template <typename T>
+GeometryBuffer<T> make_geometry_buffer(const Accessor<T> &accessor,
+                                       const std::shared_ptr<FileMapping> &mapping)
+{
+    if (reinterpret_cast<uintptr_t>(accessor.begin()) % alignof(T) == 0) {
+        // The rest of the mapped file after the data can be read as padding
+        const uint8_t *mapping_end = mapping->data() + mapping->nbytes();
+        const size_t padding =
+            (mapping_end - reinterpret_cast<const uint8_t *>(accessor.end())) / sizeof(T);
+        return GeometryBuffer<T>(accessor.begin(), accessor.size(), mapping, padding);
+    }
+    return GeometryBuffer<T>(accessor.begin(), accessor.end());
+}
+
 void Scene::load_crts(const std::string &file)
 {
     using json = nlohmann::json;
@@ -440,7 +673,7 @@ void Scene::load_crts(const std::string &file)
                             v["byte_length"].get<uint64_t>(),
                             dtype_stride(dtype));
             Accessor<glm::vec3> accessor(view);
-            geom.vertices = std::vector<glm::vec3>(accessor.begin(), accessor.end());
+            geom.vertices = make_geometry_buffer(accessor, mapping);
         }
         {
             const uint64_t view_id = m["indices"].get<uint64_t>();
@@ -450,7 +683,7 @@ void Scene::load_crts(const std::string &file)
                             v["byte_length"].get<uint64_t>(),
                             dtype_stride(dtype));
             Accessor<glm::uvec3> accessor(view);
-            geom.indices = std::vector<glm::uvec3>(accessor.begin(), accessor.end());
+            geom.indices = make_geometry_buffer(accessor, mapping);
         }
         if (m.find("texcoords") != m.end()) {
             const uint64_t view_id = m["texcoords"].get<uint64_t>();
@@ -460,7 +693,7 @@ void Scene::load_crts(const std::string &file)
                             v["byte_length"].get<uint64_t>(),
                             dtype_stride(dtype));
             Accessor<glm::vec2> accessor(view);
-            geom.uvs = std::vector<glm::vec2>(accessor.begin(), accessor.end());
+            geom.uvs = make_geometry_buffer(accessor, mapping);
         }
 #if 0
         if (m.find("normals") != m.end()) {
@@ -480,37 +713,33 @@ void Scene::load_crts(const std::string &file)
         meshes.push_back(mesh);
     }
 
-    for (size_t i = 0; i < header["images"].size(); ++i) {
-        auto &img = header["images"][i];
+    if (material_mode == MaterialMode::DEFAULT) {
+        for (size_t i = 0; i < header["images"].size(); ++i) {
+            auto &img = header["images"][i];
 
-        const uint64_t view_id = img["view"].get<uint64_t>();
-        auto &v = header["buffer_views"][view_id];
-        const DTYPE dtype = parse_dtype(v["type"]);
-        BufferView view(data_base + v["byte_offset"].get<uint64_t>(),
-                        v["byte_length"].get<uint64_t>(),
-                        dtype_stride(dtype));
-        Accessor<uint8_t> accessor(view);
+            const uint64_t view_id = img["view"].get<uint64_t>();
+            auto &v = header["buffer_views"][view_id];
+            const DTYPE dtype = parse_dtype(v["type"]);
+            BufferView view(data_base + v["byte_offset"].get<uint64_t>(),
+                            v["byte_length"].get<uint64_t>(),
+                            dtype_stride(dtype));
+            Accessor<uint8_t> accessor(view);
 
-        stbi_set_flip_vertically_on_load(1);
-        int x, y, n;
-        uint8_t *img_data =
-            stbi_load_from_memory(accessor.begin(), accessor.size(), &x, &y, &n, 4);
-        stbi_set_flip_vertically_on_load(0);
-        if (!img_data) {
-            std::cout << "Failed to load " << img["name"].get<std::string>() << " from view\n";
-            throw std::runtime_error("Failed to load " + img["name"].get<std::string>());
-        }
+            ColorSpace color_space = SRGB;
+            if (img["color_space"].get<std::string>() == "LINEAR") {
+                color_space = LINEAR;
+            }
 
-        ColorSpace color_space = SRGB;
-        if (img["color_space"].get<std::string>() == "LINEAR") {
-            color_space = LINEAR;
+            // The mapping is kept alive until the image has been decoded
+            const uint8_t *encoded = accessor.begin();
+            const size_t encoded_size = accessor.size();
+            add_deferred_texture(img["name"].get<std::string>(),
+                                 color_space,
+                                 [mapping, encoded, encoded_size](Image &texture) {
+                                     texture.decode(encoded, encoded_size, true);
+                                 });
         }
 
-        textures.emplace_back(img_data, x, y, 4, img["name"].get<std::string>(), color_space);
-        stbi_image_free(img_data);
-    }
-
-    if (material_mode == MaterialMode::DEFAULT) {
         for (size_t i = 0; i < header["materials"].size(); ++i) {
             auto &m = header["materials"][i];
 
@@ -624,6 +853,68 @@ void Scene::load_crts(const std::string &file)
 }
 
 #ifdef PBRT_PARSER_ENABLED
+/* Find the files referenced by a PBRT file and the files it includes: the included and
+ * imported files, and the files passed as "string filename" parameters (e.g., PLY meshes
+ * and image textures). Relative paths are relative to the top level file's directory
+ */
+void find_pbrt_references(const std::string &file,
+                          const std::string &base_dir,
+                          std::set<std::string> &references)
+{
+    std::ifstream fin(file.c_str());
+    if (!fin) {
+        return;
+    }
+    std::stringstream ss;
+    ss << fin.rdbuf();
+    const std::string text = ss.str();
+
+    auto resolve = [&](const std::string &path) {
+        return !path.empty() && path[0] == '/' ? path : base_dir + "/" + path;
+    };
+
+    // Tokenize the file into quoted strings and words, skipping comments
+    std::string prev_token;
+    bool prev_quoted = false;
+    size_t i = 0;
+    while (i < text.size()) {
+        const char c = text[i];
+        if (c == '#') {
+            i = text.find('\n', i);
+            continue;
+        }
+        if (std::isspace(static_cast<unsigned char>(c)) || c == '[' || c == ']') {
+            ++i;
+            continue;
+        }
+        std::string token;
+        bool quoted = false;
+        if (c == '"') {
+            const size_t end = text.find('"', i + 1);
+            if (end == std::string::npos) {
+                break;
+            }
+            token = text.substr(i + 1, end - i - 1);
+            quoted = true;
+            i = end + 1;
+        } else {
+            const size_t end = text.find_first_of(" \t\r\n\"[]#", i);
+            token = text.substr(i, end == std::string::npos ? std::string::npos : end - i);
+            i = end;
+        }
+
+        if (quoted && !prev_quoted && (prev_token == "Include" || prev_token == "Import")) {
+            const std::string included = resolve(token);
+            if (references.insert(included).second) {
+                find_pbrt_references(included, base_dir, references);
+            }
+        } else if (quoted && prev_quoted && prev_token == "string filename") {
+            references.insert(resolve(token));
+        }
+        prev_token = token;
+        prev_quoted = quoted;
+    }
+}
 
 void Scene::load_pbrt(const std::string &file)
 {
@@ -646,6 +937,11 @@ void Scene::load_pbrt(const std::string &file)
     }
 
     const std::string pbrt_base_dir = file.substr(0, file.rfind('/'));
+    if (get_file_extension(file) == "pbrt") {
+        std::set<std::string> references;
+        find_pbrt_references(file, pbrt_base_dir, references);
+        dependencies.insert(dependencies.end(), references.begin(), references.end());
+    }
 
     // TODO: The world can also have some top-level things we may need to load. But is this
     // common? Or does Ingo's make single level flatten these down to a shape?
@@ -912,18 +1208,21 @@ uint32_t Scene::load_pbrt_texture(
     if (auto t = std::dynamic_pointer_cast<pbrt::ImageTexture>(texture)) {
         std::string path = t->fileName;
         canonicalize_path(path);
-        try {
-            Image img(pbrt_base_dir + "/" + path, t->fileName, SRGB);
-            const uint32_t id = textures.size();
-            pbrt_textures[texture] = id;
-            textures.push_back(img);
-            std::cout << "Loaded image texture: " << t->fileName << "\n";
-            return id;
-        } catch (const std::runtime_error &) {
+        // Check that the image can be loaded by reading its header, the image is decoded
+        // after the scene has been loaded
+        const std::string tex_file = pbrt_base_dir + "/" + path;
+        dependencies.push_back(tex_file);
+        int x, y, n;
+        if (!stbi_info(tex_file.c_str(), &x, &y, &n)) {
             std::cout << "Unsupported file format or failed to load file: " << t->fileName
                       << "\n";
             return -1;
         }
+        const uint32_t id = add_deferred_texture(
+            t->fileName, SRGB, [tex_file](Image &img) { img.decode(tex_file, true); });
+        pbrt_textures[texture] = id;
+        std::cout << "Found image texture: " << t->fileName << "\n";
+        return id;
     }
 
     std::cout << "Texture type " << texture->toString() << " is not supported\n";
@@ -932,6 +1231,450 @@ uint32_t Scene::load_pbrt_texture(
 
 #endif
 
+uint32_t Scene::add_deferred_texture(const std::string &name,
+                                     ColorSpace color_space,
+                                     const std::function<void(Image &)> &decode)
+{
+    const uint32_t id = textures.size();
+    Image img;
+    img.name = name;
+    img.color_space = color_space;
+    textures.push_back(img);
+    deferred_textures.push_back(DeferredTexture{id, decode});
+    return id;
+}
+
+void Scene::send_geometry(SceneListener &listener) const
+{
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        listener.add_mesh(i, meshes[i]);
+    }
+    for (const auto &inst : instances) {
+        listener.add_instance(inst);
+    }
+}
+
+void Scene::decode_textures(SceneListener *listener)
+{
+    if (deferred_textures.empty()) {
+        return;
+    }
+    std::cout << "Decoding " << deferred_textures.size() << " textures\n";
+    parallel_for(deferred_textures.size(), [&](size_t i) {
+        const DeferredTexture &t = deferred_textures[i];
+        t.decode(textures[t.texture_id]);
+        if (listener) {
+            listener->add_texture(t.texture_id, textures[t.texture_id]);
+        }
+    });
+    deferred_textures.clear();
+}
+
+// Get the material parameters which can reference a texture
+std::array<float *, 12> texturable_params(DisneyMaterial &m)
+{
+    return {&m.base_color.r,
+            &m.metallic,
+            &m.specular,
+            &m.roughness,
+            &m.specular_tint,
+            &m.anisotropy,
+            &m.sheen,
+            &m.sheen_tint,
+            &m.clearcoat,
+            &m.clearcoat_gloss,
+            &m.ior,
+            &m.specular_transmission};
+}
+
+/* Build the mapping from old to new IDs for the items marked as used, unused items
+ * are mapped to -1. Returns the number of used items
+ */
+size_t build_id_remapping(const std::vector<bool> &used, std::vector<uint32_t> &remapping)
+{
+    remapping.resize(used.size(), -1);
+    size_t count = 0;
+    for (size_t i = 0; i < used.size(); ++i) {
+        if (used[i]) {
+            remapping[i] = count++;
+        }
+    }
+    return count;
+}
+
+// Remove the items which are not used from the vector, keeping the order of those left
+template <typename T>
+void compact(std::vector<T> &items, const std::vector<bool> &used)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (used[i]) {
+            if (count != i) {
+                items[count] = std::move(items[i]);
+            }
+            ++count;
+        }
+    }
+    items.erase(items.begin() + count, items.end());
+}
+
+void Scene::prune_unreferenced()
+{
+    // Mark everything reachable from the instances, and the instance groups
+    std::vector<bool> used_groups(instance_groups.size(), false);
+    std::vector<size_t> group_stack;
+    for (const auto &g : group_instances) {
+        group_stack.push_back(g.group_id);
+    }
+    while (!group_stack.empty()) {
+        const size_t id = group_stack.back();
+        group_stack.pop_back();
+        if (!used_groups[id]) {
+            used_groups[id] = true;
+            for (const auto &g : instance_groups[id].group_instances) {
+                group_stack.push_back(g.group_id);
+            }
+        }
+    }
+
+    std::vector<bool> used_parameterized_meshes(parameterized_meshes.size(), false);
+    for (const auto &i : instances) {
+        used_parameterized_meshes[i.parameterized_mesh_id] = true;
+    }
+    for (size_t i = 0; i < instance_groups.size(); ++i) {
+        if (used_groups[i]) {
+            for (const auto &inst : instance_groups[i].instances) {
+                used_parameterized_meshes[inst.parameterized_mesh_id] = true;
+            }
+        }
+    }
+
+    std::vector<bool> used_meshes(meshes.size(), false);
+    std::vector<bool> used_materials(materials.size(), false);
+    for (size_t i = 0; i < parameterized_meshes.size(); ++i) {
+        if (!used_parameterized_meshes[i]) {
+            continue;
+        }
+        used_meshes[parameterized_meshes[i].mesh_id] = true;
+        for (const auto &m : parameterized_meshes[i].material_ids) {
+            if (m != uint32_t(-1)) {
+                used_materials[m] = true;
+            }
+        }
+    }
+
+    std::vector<bool> used_textures(textures.size(), false);
+    for (size_t i = 0; i < materials.size(); ++i) {
+        if (!used_materials[i]) {
+            continue;
+        }
+        for (const float *p : texturable_params(materials[i])) {
+            const uint32_t mask = *reinterpret_cast<const uint32_t *>(p);
+            if (IS_TEXTURED_PARAM(mask) && GET_TEXTURE_ID(mask) < textures.size()) {
+                used_textures[GET_TEXTURE_ID(mask)] = true;
+            }
+        }
+    }
+
+    std::vector<uint32_t> group_remapping, parameterized_mesh_remapping, mesh_remapping,
+        material_remapping, texture_remapping;
+    const size_t num_groups = build_id_remapping(used_groups, group_remapping);
+    const size_t num_parameterized_meshes =
+        build_id_remapping(used_parameterized_meshes, parameterized_mesh_remapping);
+    const size_t num_meshes = build_id_remapping(used_meshes, mesh_remapping);
+    const size_t num_materials = build_id_remapping(used_materials, material_remapping);
+    const size_t num_textures = build_id_remapping(used_textures, texture_remapping);
+
+    if (num_groups == instance_groups.size() &&
+        num_parameterized_meshes == parameterized_meshes.size() &&
+        num_meshes == meshes.size() && num_materials == materials.size() &&
+        num_textures == textures.size()) {
+        return;
+    }
+
+    std::cout << "Removing unreferenced scene data: "
+              << instance_groups.size() - num_groups << " instance groups, "
+              << meshes.size() - num_meshes << " meshes, "
+              << parameterized_meshes.size() - num_parameterized_meshes
+              << " parameterized meshes, " << materials.size() - num_materials
+              << " materials, " << textures.size() - num_textures << " textures\n";
+
+    // Remove the unused data and remap the IDs of the remaining data
+    compact(instance_groups, used_groups);
+    auto remap_instances = [&](std::vector<Instance> &insts,
+                               std::vector<GroupInstance> &group_insts) {
+        for (auto &i : insts) {
+            i.parameterized_mesh_id = parameterized_mesh_remapping[i.parameterized_mesh_id];
+        }
+        for (auto &g : group_insts) {
+            g.group_id = group_remapping[g.group_id];
+        }
+    };
+    remap_instances(instances, group_instances);
+    for (auto &g : instance_groups) {
+        remap_instances(g.instances, g.group_instances);
+    }
+
+    compact(parameterized_meshes, used_parameterized_meshes);
+    for (auto &pm : parameterized_meshes) {
+        pm.mesh_id = mesh_remapping[pm.mesh_id];
+        for (auto &m : pm.material_ids) {
+            if (m != uint32_t(-1)) {
+                m = material_remapping[m];
+            }
+        }
+    }
+
+    compact(meshes, used_meshes);
+
+    compact(materials, used_materials);
+    for (auto &m : materials) {
+        for (float *p : texturable_params(m)) {
+            uint32_t mask = *reinterpret_cast<uint32_t *>(p);
+            if (IS_TEXTURED_PARAM(mask) && GET_TEXTURE_ID(mask) < texture_remapping.size()) {
+                const uint32_t id = texture_remapping[GET_TEXTURE_ID(mask)];
+                mask &= ~uint32_t(0x1fffffff);
+                SET_TEXTURE_ID(mask, id);
+                *p = *reinterpret_cast<float *>(&mask);
+            }
+        }
+    }
+
+    compact(textures, used_textures);
+    // Drop the decodes for textures which were removed
+    std::vector<DeferredTexture> used_deferred_textures;
+    for (auto &t : deferred_textures) {
+        if (used_textures[t.texture_id]) {
+            t.texture_id = texture_remapping[t.texture_id];
+            used_deferred_textures.push_back(std::move(t));
+        }
+    }
+    deferred_textures = std::move(used_deferred_textures);
+}
+
+template <typename T>
+bool buffers_equal(const GeometryBuffer<T> &a, const GeometryBuffer<T> &b)
+{
+    return a.size() == b.size() &&
+           (a.data() == b.data() ||
+            std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+bool geometries_equal(const Geometry &a, const Geometry &b)
+{
+    return buffers_equal(a.vertices, b.vertices) && buffers_equal(a.normals, b.normals) &&
+           buffers_equal(a.uvs, b.uvs) && buffers_equal(a.indices, b.indices);
+}
+
+void Scene::deduplicate_geometry()
+{
+    // Hash each unique buffer in the scene once, buffers shared by multiple geometries
+    // are only hashed once
+    phmap::parallel_flat_hash_map<const void *, size_t> buffer_ids;
+    std::vector<std::pair<const void *, size_t>> buffers;
+    auto add_buffer = [&](const void *data, const size_t size) {
+        if (data && buffer_ids.find(data) == buffer_ids.end()) {
+            buffer_ids[data] = buffers.size();
+            buffers.emplace_back(data, size);
+        }
+    };
+    for (const auto &m : meshes) {
+        for (const auto &g : m.geometries) {
+            add_buffer(g.vertices.data(), g.vertices.size() * sizeof(glm::vec3));
+            add_buffer(g.normals.data(), g.normals.size() * sizeof(glm::vec3));
+            add_buffer(g.uvs.data(), g.uvs.size() * sizeof(glm::vec2));
+            add_buffer(g.indices.data(), g.indices.size() * sizeof(glm::uvec3));
+        }
+    }
+    std::vector<uint64_t> buffer_hashes(buffers.size(), 0);
+    parallel_for(buffers.size(), [&](size_t i) {
+        buffer_hashes[i] = xxhash64(buffers[i].first, buffers[i].second);
+    });
+    auto buffer_hash = [&](const void *data) -> uint64_t {
+        return data ? buffer_hashes[buffer_ids[data]] : 0;
+    };
+
+    // Assign each geometry the ID of the first identical geometry found
+    struct GeometryRef {
+        size_t mesh_id;
+        size_t geometry_id;
+    };
+    std::vector<GeometryRef> unique_geometries;
+    phmap::parallel_flat_hash_map<uint64_t, std::vector<size_t>> unique_geometry_hashes;
+    std::vector<std::vector<size_t>> geometry_ids(meshes.size());
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        for (size_t j = 0; j < meshes[i].geometries.size(); ++j) {
+            const Geometry &g = meshes[i].geometries[j];
+            uint64_t hash = 0;
+            for (const uint64_t h : {buffer_hash(g.vertices.data()),
+                                     buffer_hash(g.normals.data()),
+                                     buffer_hash(g.uvs.data()),
+                                     buffer_hash(g.indices.data())}) {
+                hash = xxhash64(&h, sizeof(uint64_t), hash);
+            }
+
+            auto &candidates = unique_geometry_hashes[hash];
+            auto fnd = std::find_if(candidates.begin(), candidates.end(), [&](size_t id) {
+                const GeometryRef &ref = unique_geometries[id];
+                return geometries_equal(meshes[ref.mesh_id].geometries[ref.geometry_id], g);
+            });
+            if (fnd != candidates.end()) {
+                geometry_ids[i].push_back(*fnd);
+            } else {
+                geometry_ids[i].push_back(unique_geometries.size());
+                candidates.push_back(unique_geometries.size());
+                unique_geometries.push_back(GeometryRef{i, j});
+            }
+        }
+    }
+
+    // Merge meshes made of the same geometries
+    std::map<std::vector<size_t>, size_t> unique_meshes;
+    std::vector<size_t> mesh_remapping(meshes.size(), 0);
+    size_t merged_meshes = 0;
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        auto fnd = unique_meshes.find(geometry_ids[i]);
+        if (fnd != unique_meshes.end()) {
+            mesh_remapping[i] = fnd->second;
+            ++merged_meshes;
+        } else {
+            mesh_remapping[i] = i;
+            unique_meshes[geometry_ids[i]] = i;
+        }
+    }
+
+    // Find geometry which is still duplicated between or within the merged meshes
+    std::vector<size_t> geometry_use_count(unique_geometries.size(), 0);
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        if (mesh_remapping[i] == i) {
+            for (const auto &id : geometry_ids[i]) {
+                ++geometry_use_count[id];
+            }
+        }
+    }
+    const size_t shared_geometries =
+        std::count_if(geometry_use_count.begin(),
+                      geometry_use_count.end(),
+                      [](const size_t c) { return c > 1; });
+
+    if (merged_meshes == 0 && shared_geometries == 0) {
+        return;
+    }
+    std::cout << "Deduplicating geometry: merged " << merged_meshes
+              << " duplicate meshes, instancing " << shared_geometries
+              << " duplicated geometries\n";
+
+    /* Split the shared geometries out of the meshes into their own meshes. The
+     * geometries of each mesh which aren't shared remain together in a mesh
+     */
+    struct MeshSplit {
+        size_t rest_mesh_id = -1;
+        // The index in the original mesh of the geometries remaining in the rest mesh
+        std::vector<size_t> rest_geometries;
+        // The index in the original mesh of each shared geometry and its new mesh ID
+        std::vector<std::pair<size_t, size_t>> shared_geometries;
+    };
+    std::vector<Mesh> split_meshes;
+    std::vector<MeshSplit> mesh_splits(meshes.size());
+    std::vector<size_t> shared_mesh_ids(unique_geometries.size(), -1);
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        if (mesh_remapping[i] != i) {
+            continue;
+        }
+        MeshSplit &split = mesh_splits[i];
+        Mesh rest;
+        for (size_t j = 0; j < meshes[i].geometries.size(); ++j) {
+            const size_t id = geometry_ids[i][j];
+            if (geometry_use_count[id] > 1) {
+                if (shared_mesh_ids[id] == size_t(-1)) {
+                    shared_mesh_ids[id] = split_meshes.size();
+                    split_meshes.push_back(Mesh({meshes[i].geometries[j]}));
+                }
+                split.shared_geometries.emplace_back(j, shared_mesh_ids[id]);
+            } else {
+                split.rest_geometries.push_back(j);
+                rest.geometries.push_back(meshes[i].geometries[j]);
+            }
+        }
+        if (!rest.geometries.empty()) {
+            split.rest_mesh_id = split_meshes.size();
+            split_meshes.push_back(rest);
+        }
+    }
+
+    // Split the parameterized meshes following the meshes, sharing parameterized meshes
+    // using the same mesh and materials
+    std::map<std::pair<size_t, std::vector<uint32_t>>, size_t> unique_parameterized_meshes;
+    std::vector<ParameterizedMesh> split_parameterized_meshes;
+    auto add_parameterized_mesh = [&](size_t mesh_id, const std::vector<uint32_t> &mat_ids) {
+        const auto key = std::make_pair(mesh_id, mat_ids);
+        auto fnd = unique_parameterized_meshes.find(key);
+        if (fnd != unique_parameterized_meshes.end()) {
+            return fnd->second;
+        }
+        const size_t id = split_parameterized_meshes.size();
+        unique_parameterized_meshes[key] = id;
+        split_parameterized_meshes.emplace_back(mesh_id, mat_ids);
+        return id;
+    };
+    std::vector<std::vector<size_t>> parameterized_mesh_splits(parameterized_meshes.size());
+    for (size_t i = 0; i < parameterized_meshes.size(); ++i) {
+        const ParameterizedMesh &pm = parameterized_meshes[i];
+        const MeshSplit &split = mesh_splits[mesh_remapping[pm.mesh_id]];
+        if (split.rest_mesh_id != size_t(-1)) {
+            std::vector<uint32_t> material_ids;
+            for (const auto &j : split.rest_geometries) {
+                material_ids.push_back(pm.material_ids[j]);
+            }
+            parameterized_mesh_splits[i].push_back(
+                add_parameterized_mesh(split.rest_mesh_id, material_ids));
+        }
+        for (const auto &g : split.shared_geometries) {
+            parameterized_mesh_splits[i].push_back(
+                add_parameterized_mesh(g.second, {pm.material_ids[g.first]}));
+        }
+    }
+
+    // Each instance of a split parameterized mesh becomes an instance of each of the
+    // parameterized meshes it was split into
+    auto split_instances = [&](const std::vector<Instance> &insts) {
+        std::vector<Instance> split;
+        for (const auto &inst : insts) {
+            for (const auto &pm : parameterized_mesh_splits[inst.parameterized_mesh_id]) {
+                split.emplace_back(inst.transform, pm);
+            }
+        }
+        return split;
+    };
+
+    meshes = std::move(split_meshes);
+    parameterized_meshes = std::move(split_parameterized_meshes);
+    instances = split_instances(instances);
+    for (auto &g : instance_groups) {
+        g.instances = split_instances(g.instances);
+    }
+}
+
+void Scene::pad_vertex_buffers()
+{
+    phmap::parallel_flat_hash_map<const glm::vec3 *, GeometryBuffer<glm::vec3>> padded;
+    for (auto &m : meshes) {
+        for (auto &g : m.geometries) {
+            if (g.vertices.padding() > 0) {
+                continue;
+            }
+            auto fnd = padded.find(g.vertices.data());
+            if (fnd != padded.end()) {
+                g.vertices = fnd->second;
+            } else {
+                const glm::vec3 *unpadded = g.vertices.data();
+                g.vertices.pad(1);
+                padded[unpadded] = g.vertices;
+            }
+        }
+    }
+}
+
 void Scene::validate_materials()
 {
     const bool need_default_mat =
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -20,18 +21,63 @@
  */
 enum class MaterialMode { DEFAULT, WHITE_DIFFUSE };
 
+/* A texture whose decoding is deferred until the scene has finished loading, so that
+ * all the scene's textures can be decoded in parallel. The decode function fills in the
+ * image data of the texture, the texture's name and color space are set by the loader.
+ */
+struct DeferredTexture {
+    size_t texture_id;
+    std::function<void(Image &)> decode;
+};
+
+/* Receives the parts of a scene while it's being loaded, so that work on them (e.g., building
+ * BVHs or uploading textures) can overlap with the end of the load. Meshes and instances
+ * are passed once the scene's geometry is final, after the file has been parsed and the
+ * meshes pruned, deduplicated and padded, with the IDs they have in the loaded scene. Work
+ * on the meshes can't overlap parsing, only decoding the textures and writing the scene
+ * cache. Textures are passed as they're decoded and may be passed concurrently from
+ * multiple threads. Instances of instance groups aren't passed, and the instances may
+ * still change (e.g., if the scene is flattened) after loading, so the loaded scene should
+ * be used for the final instancing. The data passed remains valid for the scene's lifetime.
+ */
+struct SceneListener {
+    virtual ~SceneListener() {}
+
+    virtual void add_mesh(const uint32_t, const Mesh &) {}
+
+    virtual void add_texture(const uint32_t, const Image &) {}
+
+    virtual void add_instance(const Instance &) {}
+};
+
 struct Scene {
     std::vector<Mesh> meshes;
     std::vector<ParameterizedMesh> parameterized_meshes;
     std::vector<Instance> instances;
+    // Instances of instance groups at the top level of the scene. Loaders which read
+    // multi-level instanced scenes keep the hierarchy in the instance groups
+    std::vector<GroupInstance> group_instances;
+    std::vector<InstanceGroup> instance_groups;
     std::vector<DisneyMaterial> materials;
     std::vector<Image> textures;
     std::vector<QuadLight> lights;
     std::vector<Camera> cameras;
     uint32_t samples_per_pixel = 1;
     MaterialMode material_mode = MaterialMode::DEFAULT;
+    // The files other than the scene file which were read, or looked for, to load the
+    // scene (e.g., OBJ material files, glTF buffers, PBRT includes and textures). The
+    // scene cache is invalidated if any of them change
+    std::vector<std::string> dependencies;
 
-    Scene(const std::string &fname, MaterialMode material_mode);
+    /* If use_cache is set the scene will be loaded from the scene cache if it's valid,
+     * otherwise the cache will be written after loading the scene. See scene_cache.h.
+     * If a listener is passed it's sent the scene's meshes, instances and textures as
+     * they're loaded, see SceneListener
+     */
+    Scene(const std::string &fname,
+          MaterialMode material_mode,
+          bool use_cache = true,
+          SceneListener *listener = nullptr);
     Scene() = default;
 
     // Compute the unique number of triangles in the scene
@@ -42,7 +88,21 @@ struct Scene {
 
     size_t num_geometries() const;
 
+    // Count the instances and group instances stored in the scene (before instancing)
+    size_t num_instances() const;
+
+    // Compute the number of levels of instancing in the scene, 1 for single level
+    size_t instance_levels() const;
+
+    /* Expand the instance groups into single level instancing, replacing the group
+     * instances with the instances of the groups' meshes they place in the scene.
+     * This is done for backends which don't support multi-level instancing.
+     */
+    void flatten_instances();
+
 private:
+    std::vector<DeferredTexture> deferred_textures;
+
     void load_obj(const std::string &file);
 
     void load_gltf(const std::string &file);
@@ -66,4 +126,37 @@ private:
 #endif
 
     void validate_materials();
+
+    /* Remove instance groups, meshes, parameterized meshes, materials and textures which
+     * aren't reachable from the scene's instances, remapping the IDs of the remaining
+     * ones. Deferred textures which are removed are not decoded.
+     */
+    void prune_unreferenced();
+
+    /* Find identical geometry in the scene and share it through instancing. Meshes whose
+     * geometries are all identical are merged, and geometries which appear in multiple
+     * meshes (or multiple times in a mesh) are split out into their own mesh which is
+     * instanced in place of each copy. Geometry sharing the same buffers (e.g., glTF
+     * primitives using the same accessors) is found without comparing the data, other
+     * geometry is compared by content hash.
+     */
+    void deduplicate_geometry();
+
+    /* Pad the vertex buffers with an extra vertex so backends can share them directly
+     * with APIs which read past the end of the buffer (e.g., Embree). Buffers shared by
+     * multiple geometries are padded once and remain shared.
+     */
+    void pad_vertex_buffers();
+
+    // Add a texture to be decoded by decode_textures, returns the texture's ID
+    uint32_t add_deferred_texture(const std::string &name,
+                                  ColorSpace color_space,
+                                  const std::function<void(Image &)> &decode);
+
+    // Send the scene's meshes and top level instances to the listener
+    void send_geometry(SceneListener &listener) const;
+
+    // Decode all deferred textures in parallel, sending each to the listener if one is
+    // passed once it's decoded
+    void decode_textures(SceneListener *listener);
 };
@@ -0,0 +1,505 @@
+#include "scene_cache.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include "file_mapping.h"
+#include "parallel_for.h"
+#include "util.h"
+#include <glm/glm.hpp>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace {
+
+const char CACHE_MAGIC[8] = {'C', 'R', 'T', 'C', 'A', 'C', 'H', 'E'};
+// Bump the version when changing the layout of the cache
+const uint32_t CACHE_VERSION = 6;
+// Arrays in the cache are aligned so they can be used directly from the mapped file
+const size_t CACHE_ALIGNMENT = 16;
+// Files are hashed in parallel in blocks of this size
+const size_t HASH_BLOCK_SIZE = 64 * 1024 * 1024;
+
+/* The header is followed by the files read to load the scene, starting with the scene
+ * file, each stored as its path followed by its FileStamp. The scene data follows the
+ * files
+ */
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t material_mode;
+    // Sizes of the types stored directly in the cache, to detect changes to their layout
+    uint32_t type_sizes[4];
+};
+
+/* The state of a file read to load the scene when the cache was written. Files which
+ * were looked for but didn't exist (e.g., an MTL file which wasn't found) are recorded
+ * too, so the cache is invalidated if they're created
+ */
+struct FileStamp {
+    uint64_t exists;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t content_hash;
+};
+
+struct SourceInfo {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+bool stat_file(const std::string &file, SourceInfo &info)
+{
+#ifdef _WIN32
+    struct _stat64 s;
+    if (_stat64(file.c_str(), &s) != 0) {
+        return false;
+    }
+    info.mtime = s.st_mtime;
+#else
+    struct stat s;
+    if (stat(file.c_str(), &s) != 0) {
+        return false;
+    }
+#if defined(__linux__)
+    // Use the nanosecond modification time where available, so files modified within the
+    // same second as the cache was written are still detected
+    info.mtime = int64_t(s.st_mtim.tv_sec) * 1000000000 + s.st_mtim.tv_nsec;
+#else
+    info.mtime = s.st_mtime;
+#endif
+#endif
+    info.size = s.st_size;
+    return true;
+}
+
+// Hash the file contents, hashing blocks of the file in parallel and combining the hashes
+uint64_t hash_file(const std::string &file)
+{
+    SourceInfo info;
+    if (stat_file(file, info) && info.size == 0) {
+        // Empty files can't be mapped
+        return xxhash64(nullptr, 0);
+    }
+    FileMapping mapping(file);
+    const size_t num_blocks = (mapping.nbytes() + HASH_BLOCK_SIZE - 1) / HASH_BLOCK_SIZE;
+    std::vector<uint64_t> block_hashes(num_blocks, 0);
+    parallel_for(num_blocks, [&](size_t i) {
+        const size_t begin = i * HASH_BLOCK_SIZE;
+        const size_t size = std::min(HASH_BLOCK_SIZE, mapping.nbytes() - begin);
+        block_hashes[i] = xxhash64(mapping.data() + begin, size);
+    });
+    return xxhash64(block_hashes.data(), block_hashes.size() * sizeof(uint64_t));
+}
+
+void fill_type_sizes(CacheHeader &header)
+{
+    header.type_sizes[0] = sizeof(DisneyMaterial);
+    header.type_sizes[1] = sizeof(QuadLight);
+    header.type_sizes[2] = sizeof(Camera);
+    header.type_sizes[3] = sizeof(glm::mat4);
+}
+
+class CacheWriter {
+    std::ofstream fout;
+    size_t offset = 0;
+
+public:
+    CacheWriter(const std::string &file) : fout(file.c_str(), std::ios::binary)
+    {
+        if (!fout) {
+            throw std::runtime_error("Failed to open " + file + " for writing");
+        }
+    }
+
+    void write(const void *data, const size_t size)
+    {
+        fout.write(reinterpret_cast<const char *>(data), size);
+        offset += size;
+    }
+
+    template <typename T>
+    void write(const T &t)
+    {
+        write(&t, sizeof(T));
+    }
+
+    // Write the count of the array, followed by its data aligned to CACHE_ALIGNMENT
+    template <typename T>
+    void write_array(const T *data, const size_t count)
+    {
+        write(uint64_t(count));
+        const size_t padding = (CACHE_ALIGNMENT - offset % CACHE_ALIGNMENT) % CACHE_ALIGNMENT;
+        const uint8_t zeros[CACHE_ALIGNMENT] = {0};
+        write(zeros, padding);
+        write(data, count * sizeof(T));
+    }
+
+    // Write an array followed by CACHE_ALIGNMENT bytes of padding, see read_geometry_buffer
+    template <typename T>
+    void write_geometry_array(const GeometryBuffer<T> &buffer)
+    {
+        write_array(buffer.data(), buffer.size());
+        const uint8_t zeros[CACHE_ALIGNMENT] = {0};
+        write(zeros, CACHE_ALIGNMENT);
+    }
+
+    void write_string(const std::string &str)
+    {
+        write_array(str.data(), str.size());
+    }
+
+    void close()
+    {
+        fout.close();
+        if (!fout) {
+            throw std::runtime_error("Failed to write cache file");
+        }
+    }
+};
+
+class CacheReader {
+    std::shared_ptr<FileMapping> mapping;
+    size_t offset = 0;
+
+    const uint8_t *advance(const size_t size)
+    {
+        if (size > mapping->nbytes() - offset) {
+            throw std::runtime_error("Truncated scene cache file");
+        }
+        const uint8_t *ptr = mapping->data() + offset;
+        offset += size;
+        return ptr;
+    }
+
+public:
+    CacheReader(const std::shared_ptr<FileMapping> &mapping, const size_t offset = 0)
+        : mapping(mapping), offset(offset)
+    {
+    }
+
+    size_t position() const
+    {
+        return offset;
+    }
+
+    template <typename T>
+    T read()
+    {
+        T t;
+        std::memcpy(&t, advance(sizeof(T)), sizeof(T));
+        return t;
+    }
+
+    template <typename T>
+    const T *read_array(size_t &count)
+    {
+        count = read<uint64_t>();
+        advance((CACHE_ALIGNMENT - offset % CACHE_ALIGNMENT) % CACHE_ALIGNMENT);
+        return reinterpret_cast<const T *>(advance(count * sizeof(T)));
+    }
+
+    template <typename T>
+    std::vector<T> read_vector()
+    {
+        size_t count = 0;
+        const T *data = read_array<T>(count);
+        return std::vector<T>(data, data + count);
+    }
+
+    // Read an array which will reference the mapped cache file directly, the padding
+    // written after the array can be read past the end of the buffer
+    template <typename T>
+    GeometryBuffer<T> read_geometry_buffer()
+    {
+        size_t count = 0;
+        const T *data = read_array<T>(count);
+        advance(CACHE_ALIGNMENT);
+        return GeometryBuffer<T>(data, count, mapping, CACHE_ALIGNMENT / sizeof(T));
+    }
+
+    std::string read_string()
+    {
+        size_t count = 0;
+        const char *data = read_array<char>(count);
+        return std::string(data, data + count);
+    }
+};
+
+void read_instances(CacheReader &reader,
+                    std::vector<Instance> &instances,
+                    std::vector<GroupInstance> &group_instances)
+{
+    instances.resize(reader.read<uint64_t>());
+    for (auto &inst : instances) {
+        inst.transform = reader.read<glm::mat4>();
+        inst.parameterized_mesh_id = reader.read<uint64_t>();
+    }
+    group_instances.resize(reader.read<uint64_t>());
+    for (auto &inst : group_instances) {
+        inst.transform = reader.read<glm::mat4>();
+        inst.group_id = reader.read<uint64_t>();
+    }
+}
+
+void write_instances(CacheWriter &writer,
+                     const std::vector<Instance> &instances,
+                     const std::vector<GroupInstance> &group_instances)
+{
+    writer.write(uint64_t(instances.size()));
+    for (const auto &inst : instances) {
+        writer.write(inst.transform);
+        writer.write(uint64_t(inst.parameterized_mesh_id));
+    }
+    writer.write(uint64_t(group_instances.size()));
+    for (const auto &inst : group_instances) {
+        writer.write(inst.transform);
+        writer.write(uint64_t(inst.group_id));
+    }
+}
+
+void read_scene(CacheReader &reader, Scene &scene)
+{
+    scene.meshes.resize(reader.read<uint64_t>());
+    for (auto &mesh : scene.meshes) {
+        mesh.geometries.resize(reader.read<uint64_t>());
+        for (auto &geom : mesh.geometries) {
+            geom.vertices = reader.read_geometry_buffer<glm::vec3>();
+            geom.normals = reader.read_geometry_buffer<glm::vec3>();
+            geom.uvs = reader.read_geometry_buffer<glm::vec2>();
+            geom.indices = reader.read_geometry_buffer<glm::uvec3>();
+        }
+    }
+
+    scene.parameterized_meshes.resize(reader.read<uint64_t>());
+    for (auto &pm : scene.parameterized_meshes) {
+        pm.mesh_id = reader.read<uint64_t>();
+        pm.material_ids = reader.read_vector<uint32_t>();
+    }
+
+    read_instances(reader, scene.instances, scene.group_instances);
+    scene.instance_groups.resize(reader.read<uint64_t>());
+    for (auto &group : scene.instance_groups) {
+        read_instances(reader, group.instances, group.group_instances);
+    }
+
+    scene.materials = reader.read_vector<DisneyMaterial>();
+
+    scene.textures.resize(reader.read<uint64_t>());
+    for (auto &img : scene.textures) {
+        img.name = reader.read_string();
+        img.width = reader.read<int32_t>();
+        img.height = reader.read<int32_t>();
+        img.channels = reader.read<int32_t>();
+        img.color_space = static_cast<ColorSpace>(reader.read<uint32_t>());
+        // The texels reference the mapped cache like the geometry
+        img.img = reader.read_geometry_buffer<uint8_t>();
+    }
+
+    scene.lights = reader.read_vector<QuadLight>();
+    scene.cameras = reader.read_vector<Camera>();
+}
+
+void write_scene(CacheWriter &writer, const Scene &scene)
+{
+    writer.write(uint64_t(scene.meshes.size()));
+    for (const auto &mesh : scene.meshes) {
+        writer.write(uint64_t(mesh.geometries.size()));
+        for (const auto &geom : mesh.geometries) {
+            writer.write_geometry_array(geom.vertices);
+            writer.write_geometry_array(geom.normals);
+            writer.write_geometry_array(geom.uvs);
+            writer.write_geometry_array(geom.indices);
+        }
+    }
+
+    writer.write(uint64_t(scene.parameterized_meshes.size()));
+    for (const auto &pm : scene.parameterized_meshes) {
+        writer.write(uint64_t(pm.mesh_id));
+        writer.write_array(pm.material_ids.data(), pm.material_ids.size());
+    }
+
+    write_instances(writer, scene.instances, scene.group_instances);
+    writer.write(uint64_t(scene.instance_groups.size()));
+    for (const auto &group : scene.instance_groups) {
+        write_instances(writer, group.instances, group.group_instances);
+    }
+
+    writer.write_array(scene.materials.data(), scene.materials.size());
+
+    writer.write(uint64_t(scene.textures.size()));
+    for (const auto &img : scene.textures) {
+        writer.write_string(img.name);
+        writer.write(int32_t(img.width));
+        writer.write(int32_t(img.height));
+        writer.write(int32_t(img.channels));
+        writer.write(uint32_t(img.color_space));
+        writer.write_geometry_array(img.img);
+    }
+
+    writer.write_array(scene.lights.data(), scene.lights.size());
+    writer.write_array(scene.cameras.data(), scene.cameras.size());
+}
+
+// Update the modification times stored in the file stamps at the given offsets
+void update_file_mtimes(const std::string &cache_file,
+                        const std::vector<std::pair<size_t, int64_t>> &mtimes)
+{
+    std::fstream fout(cache_file.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+    for (const auto &m : mtimes) {
+        fout.seekp(m.first + offsetof(FileStamp, mtime));
+        fout.write(reinterpret_cast<const char *>(&m.second), sizeof(m.second));
+    }
+    if (!fout) {
+        std::cout << "Failed to update the modification times in scene cache " << cache_file
+                  << "\n";
+    }
+}
+
+}
+
+std::string scene_cache_file(const std::string &scene_file)
+{
+    return scene_file + ".crtcache";
+}
+
+bool load_scene_cache(const std::string &scene_file, Scene &scene)
+{
+    const std::string cache_file = scene_cache_file(scene_file);
+    SourceInfo source, cache;
+    if (!stat_file(scene_file, source) || !stat_file(cache_file, cache)) {
+        return false;
+    }
+
+    try {
+        auto mapping = std::make_shared<FileMapping>(cache_file);
+        CacheReader reader(mapping);
+
+        const CacheHeader header = reader.read<CacheHeader>();
+        CacheHeader expected_header;
+        fill_type_sizes(expected_header);
+        if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+            header.version != CACHE_VERSION ||
+            header.material_mode != uint32_t(scene.material_mode) ||
+            std::memcmp(header.type_sizes,
+                        expected_header.type_sizes,
+                        sizeof(header.type_sizes)) != 0) {
+            std::cout << "Scene cache " << cache_file << " is out of date\n";
+            return false;
+        }
+
+        // Check that none of the files read to load the scene have changed. A file's
+        // contents are only hashed if its modification time doesn't match
+        const uint64_t num_files = reader.read<uint64_t>();
+        std::vector<std::string> dependencies;
+        // The offsets of the stamps of files which were touched but not changed, and
+        // their new modification times
+        std::vector<std::pair<size_t, int64_t>> touched;
+        for (uint64_t i = 0; i < num_files; ++i) {
+            const std::string file = reader.read_string();
+            const size_t stamp_offset = reader.position();
+            const FileStamp stamp = reader.read<FileStamp>();
+            SourceInfo info;
+            const bool exists = stat_file(file, info);
+            bool changed = (i == 0 && file != scene_file) || exists != (stamp.exists != 0) ||
+                           (exists && info.size != stamp.size);
+            if (!changed && exists && info.mtime != stamp.mtime) {
+                changed = hash_file(file) != stamp.content_hash;
+                touched.emplace_back(stamp_offset, info.mtime);
+            }
+            if (changed) {
+                std::cout << "Scene cache " << cache_file << " is out of date, " << file
+                          << " has changed\n";
+                return false;
+            }
+            if (i != 0) {
+                dependencies.push_back(file);
+            }
+        }
+
+        if (!touched.empty()) {
+            // Store the new modification times so the touched files aren't hashed again on
+            // every load. The cache is unmapped while it's updated, as Windows doesn't
+            // allow writing to a mapped file
+            const size_t data_offset = reader.position();
+            reader = CacheReader(nullptr);
+            mapping = nullptr;
+            update_file_mtimes(cache_file, touched);
+            mapping = std::make_shared<FileMapping>(cache_file);
+            reader = CacheReader(mapping, data_offset);
+        }
+
+        std::cout << "Loading scene cache " << cache_file << "\n";
+        Scene cached;
+        cached.material_mode = scene.material_mode;
+        cached.dependencies = std::move(dependencies);
+        read_scene(reader, cached);
+        scene = std::move(cached);
+    } catch (const std::exception &e) {
+        std::cout << "Failed to load scene cache " << cache_file << ": " << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
+
+void write_scene_cache(const std::string &scene_file, const Scene &scene)
+{
+    const std::string cache_file = scene_cache_file(scene_file);
+    SourceInfo source;
+    if (!stat_file(scene_file, source)) {
+        return;
+    }
+
+    std::cout << "Writing scene cache " << cache_file << "\n";
+    CacheHeader header;
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.material_mode = uint32_t(scene.material_mode);
+    fill_type_sizes(header);
+
+    std::vector<std::string> dependencies = scene.dependencies;
+    std::sort(dependencies.begin(), dependencies.end());
+    dependencies.erase(std::unique(dependencies.begin(), dependencies.end()),
+                       dependencies.end());
+    dependencies.erase(std::remove(dependencies.begin(), dependencies.end(), scene_file),
+                       dependencies.end());
+    std::vector<std::string> files = {scene_file};
+    files.insert(files.end(), dependencies.begin(), dependencies.end());
+
+    // Write to a temporary file and move it into place once it's complete, so that an
+    // interrupted write doesn't leave a truncated cache file
+    const std::string tmp_file = cache_file + ".tmp";
+    try {
+        CacheWriter writer(tmp_file);
+        writer.write(header);
+        writer.write(uint64_t(files.size()));
+        for (const auto &file : files) {
+            FileStamp stamp = {};
+            SourceInfo info;
+            if (stat_file(file, info)) {
+                stamp.exists = 1;
+                stamp.size = info.size;
+                stamp.mtime = info.mtime;
+                stamp.content_hash = hash_file(file);
+            }
+            writer.write_string(file);
+            writer.write(stamp);
+        }
+        write_scene(writer, scene);
+        writer.close();
+
+        std::remove(cache_file.c_str());
+        if (std::rename(tmp_file.c_str(), cache_file.c_str()) != 0) {
+            throw std::runtime_error("Failed to rename " + tmp_file + " to " + cache_file);
+        }
+    } catch (const std::runtime_error &e) {
+        std::remove(tmp_file.c_str());
+        std::cout << "Warning: failed to write scene cache " << cache_file << ": "
+                  << e.what() << "\n";
+    }
+}
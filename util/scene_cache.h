@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include "scene.h"
+
+/* The scene cache stores the fully loaded state of a scene (geometry, instancing,
+ * materials, decoded textures, lights and cameras) in <scene file>.crtcache next to the
+ * scene file. The cache is keyed on the scene file path, size, modification time and
+ * a hash of its contents, along with the material mode the scene was loaded with. The
+ * same is stored for each of the files the scene references (Scene::dependencies, e.g.,
+ * OBJ materials, glTF buffers and images or PBRT includes), and the cache is invalidated
+ * if any of them change. The cache is mapped when loaded and the geometry and texture
+ * data reference the mapped data directly.
+ */
+std::string scene_cache_file(const std::string &scene_file);
+
+/* Load the scene from the cache for scene_file, if one exists and is still valid for the
+ * scene file, the files it references and the scene's material mode. A file's content
+ * hash is only recomputed and checked if its modification time doesn't match, so
+ * touching a file doesn't invalidate the cache. The new modification times of touched
+ * files are written back to the cache so they're only hashed once. Returns true if the
+ * scene was loaded from the cache.
+ */
+bool load_scene_cache(const std::string &scene_file, Scene &scene);
+
+// Write the scene loaded from scene_file to its cache file
+void write_scene_cache(const std::string &scene_file, const Scene &scene);
@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <array>
+#include <cstring>
 #ifdef _WIN32
 #include <intrin.h>
 #elif !defined(__aarch64__)
@@ -119,3 +120,94 @@ float luminance(const glm::vec3 &c)
 {
     return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
 }
+
+namespace {
+
+const uint64_t XXH_PRIME64_1 = 0x9e3779b185ebca87ULL;
+const uint64_t XXH_PRIME64_2 = 0xc2b2ae3d27d4eb4fULL;
+const uint64_t XXH_PRIME64_3 = 0x165667b19e3779f9ULL;
+const uint64_t XXH_PRIME64_4 = 0x85ebca77c2b2ae63ULL;
+const uint64_t XXH_PRIME64_5 = 0x27d4eb2f165667c5ULL;
+
+uint64_t rotl64(const uint64_t x, const int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t read_u64(const uint8_t *p)
+{
+    uint64_t x;
+    std::memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+uint32_t read_u32(const uint8_t *p)
+{
+    uint32_t x;
+    std::memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+uint64_t xxh64_round(uint64_t acc, const uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+uint64_t xxh64_merge_round(uint64_t acc, const uint64_t val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+}
+
+uint64_t xxhash64(const void *data, const size_t size, const uint64_t seed)
+{
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(data);
+    const uint8_t *end = p + size;
+    uint64_t h;
+    if (size >= 32) {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = xxh64_round(v1, read_u64(p));
+            v2 = xxh64_round(v2, read_u64(p + 8));
+            v3 = xxh64_round(v3, read_u64(p + 16));
+            v4 = xxh64_round(v4, read_u64(p + 24));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge_round(h, v1);
+        h = xxh64_merge_round(h, v2);
+        h = xxh64_merge_round(h, v3);
+        h = xxh64_merge_round(h, v4);
+    } else {
+        h = seed + XXH_PRIME64_5;
+    }
+    h += uint64_t(size);
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh64_round(0, read_u64(p));
+        h = rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= uint64_t(read_u32(p)) * XXH_PRIME64_1;
+        h = rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= uint64_t(*p) * XXH_PRIME64_5;
+        h = rotl64(h, 11) * XXH_PRIME64_1;
+    }
+
+    // Final avalanche so that every input bit affects every output bit
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
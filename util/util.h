@@ -21,3 +21,8 @@ float srgb_to_linear(const float x);
 float linear_to_srgb(const float x);
 
 float luminance(const glm::vec3 &c);
+
+/* The 64-bit xxHash (XXH64) of the data. Hashes can be chained by passing the previous
+ * hash as the seed
+ */
+uint64_t xxhash64(const void *data, const size_t size, const uint64_t seed = 0);